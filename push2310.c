@@ -1,997 +1,6656 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <limits.h>
+#include <time.h>
+#include <float.h>
+#include <math.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <pthread.h>
+
+/* SSE2 and AVX2 kernels are built on x86-64, and chosen when they run by
+ * what the processor supports */
+#if defined(__x86_64__) && defined(__GNUC__)
+#define SIMD_X86
+#include <immintrin.h>
+#endif
+
+/* Counters and timers built in with -DSTATS (make stats) and reported as
+ * JSON at the end of each game; in other builds they compile to nothing
+ * STATS_START and STATS_STOP time a call to an instrumented function
+ * between them, and every allocation is counted by wrapping malloc, calloc
+ * and realloc
+ * */
+#ifdef STATS
+#define STATS_START uint64_t statsStart = read_cycles()
+#define STATS_STOP(kind) record_call(kind, statsStart)
+#define STATS_ADD(field, amount) \
+	__atomic_fetch_add(&stats.field, amount, __ATOMIC_RELAXED)
+#define STATS_REPORT() print_stats()
+#define malloc(size) stats_malloc(size)
+#define calloc(count, size) stats_calloc(count, size)
+#define realloc(pointer, size) stats_realloc(pointer, size)
+#else
+#define STATS_START
+#define STATS_STOP(kind)
+#define STATS_ADD(field, amount)
+#define STATS_REPORT()
+#endif
+
+/* Functions timed in a stats build */
+#define STAT_VALID_POSITION 0
+#define STAT_VALID_PUSH 1
+#define STAT_PUSH_STONES 2
+#define STAT_DECREASE_SCORE 3
+#define STAT_ROW_SCORE 4
+#define STAT_COLUMN_SCORE 5
+#define STAT_PLANE_SCORE 6
+#define STAT_KINDS 7
+
+/* Number of positions packed into each word of a bit plane */
+#define PLANE_BITS 64
+
+/* Fewest positions the vector kernels add up; shorter spans are added a
+ * bit at a time, which is quicker than setting up and reducing a vector */
+#define SIMD_MIN_SPAN 16
+
+/* Deepest the search player will look ahead, in moves */
+#define MAX_SEARCH_DEPTH 64
+
+/* Number of nodes the search visits between checks of the clock */
+#define CLOCK_CHECK_NODES 1024
+
+/* Time the search player may spend on a move unless told otherwise (ms) */
+#define DEFAULT_THINK_TIME 1000
+
+/* Empty interior positions at or below which the automated players solve
+ * the endgame exactly unless told otherwise */
+#define DEFAULT_SOLVE_EMPTIES 10
+
+/* Nodes an endgame solve may visit when moves must not depend on timing */
+#define SOLVE_NODE_LIMIT (1L << 20)
+
+/* Moves played after an endgame solve fails before the next is tried */
+#define SOLVE_RETRY_MOVES 4
+
+/* Depth stored in the transposition table for positions solved to the end
+ * of the game, deeper than any search reaches */
+#define SOLVED_DEPTH 0xff
+
+/* Weight given to exploring rarely visited moves in a Monte Carlo tree */
+#define EXPLORATION 1.4
+
+/* Results of loading a savefile, each the exit status for that result */
+#define LOAD_OK 0
+#define LOAD_INVALID 4
+#define LOAD_FULL 6
+
+/* Start of a binary savefile, followed by its format version
+ * A binary savefile holds a header of BINARY_HEADER bytes: the magic, the
+ * version, the player to move, the rows and columns (4 bytes each) and a
+ * checksum of the planes (8 bytes), all little endian
+ * The header is followed by the stone plane, 2 bits for each position in
+ * row order (STONE_BLANK, STONE_EMPTY, STONE_O or STONE_X), and then the
+ * score plane, 4 bits for each position, which must all be from 0 to 9
+ * */
+#define BINARY_MAGIC "P2310B"
+#define BINARY_MAGIC_LENGTH 6
+#define BINARY_VERSION 1
+#define BINARY_HEADER 24
+
+/* Codes of the stones in a binary savefile's stone plane */
+#define STONE_BLANK 0
+#define STONE_EMPTY 1
+#define STONE_O 2
+#define STONE_X 3
+
+#ifdef BENCH
+/* Number of timed runs of each benchmark, after a warmup run */
+#define BENCH_REPETITIONS 7
+
+/* Shortest time a timed run of a benchmark may take (ms) */
+#define BENCH_MIN_TIME 5.0
+
+/* Number of benchmark kernels, board sizes and fill densities */
+#define BENCH_KERNELS 10
+#define BENCH_SIZES 5
+#define BENCH_DENSITIES 4
+#endif
+
+/* Opening book files start with this magic and version, followed by the
+ * number of slots in their hash table and then the slots themselves */
+#define BOOK_MAGIC "P2310K"
+#define BOOK_MAGIC_LENGTH 6
+#define BOOK_VERSION 1
+#define BOOK_HEADER 16
+#define BOOK_ENTRY 16
+
+/* Move held by an empty slot of an opening book */
+#define BOOK_EMPTY 0xffffffffU
+
+/* Alignment of every allocation made from an arena (bytes) */
+#define ARENA_ALIGN 16
+
+/* Longest line a human player's input is read into before it must grow */
+#define LINE_LENGTH 81
+
+/* Most text rendered at once when a board is written out a few rows at a
+ * time rather than from its kept text (bytes) */
+#define RENDER_CHUNK 65536
+
+/* Output modes other than displaying the board every n moves */
+#define DISPLAY_NONE 0
+#define DISPLAY_FINAL -1
+
+/* Longest reply the engine protocol gives to a command (bytes) */
+#define REPLY_LENGTH 80
+
+/* Connections to the game server are allocated this many at a time, and
+ * kept for later connections once closed */
+#define SERVER_SLAB 256
+
+/* Longest command line a connection to the game server may send (bytes) */
+#define SERVER_INPUT 4096
+
+/* Most events the game server handles from one wait */
+#define SERVER_EVENTS 64
+
+/* Longest the game server waits before trying to accept connections again
+ * after running out of file descriptors, if none of its own close (ms) */
+#define SERVER_RETRY 100
+
+/* Size of the transposition table unless told otherwise (megabytes) */
+#define DEFAULT_TABLE_SIZE 16
+
+/* Key folded into a position's hash when it is player X's turn */
+#define SIDE_KEY 0xd6e8feb86659fd93ULL
+
+/* Bounds a transposition table value may be */
+#define BOUND_EXACT 1
+#define BOUND_LOWER 2
+#define BOUND_UPPER 3
+
+/* Bits at the bottom of a table entry's lock word which hold its bound,
+ * depth and age rather than part of the key
+ * */
+#define ENTRY_INFO_BITS 16
+
+/* An opening book mapped into memory from a book file, shared with any
+ * other process using the same book through the page cache
+ * The book is a hash table of mask + 1 slots (a power of two) of
+ * BOOK_ENTRY bytes, indexed by the low bits of book_key, with collisions
+ * placed in the following slots; each slot holds a key (8 bytes), the move
+ * to play (4 bytes, BOOK_EMPTY in an empty slot) and the depth the move
+ * was searched to (4 bytes), all little endian
+ * data is NULL if there is no book
+ * */
+typedef struct {
+    unsigned char* data;
+    size_t length;
+    uint64_t mask;
+} Book;
+
+/* A position added to an opening book as it is built */
+typedef struct {
+    uint64_t key;
+    int move;
+    int depth;
+} BookEntry;
+
+/* Scratch memory handed out by moving along one block, and given back all
+ * at once by reset_arena without freeing it
+ * Allocations which do not fit in the block are made on the heap and kept
+ * in a list (overflow, each starting with a pointer to the one before,
+ * overflowBytes in all); a reset frees them and grows the block by as much,
+ * so once an arena has met its largest use it never allocates again
+ * */
+typedef struct {
+    char* block;
+    size_t size;
+    size_t used;
+    void* overflow;
+    size_t overflowBytes;
+} Arena;
+
+/* Options given on the command line before the player types
+ * thinkTime - the wall clock budget for each search player move (ms)
+ * tableSize - the memory given to the transposition table (megabytes)
+ * threads - the number of threads each search uses
+ * searchDepth - the fixed depth of each search, or 0 to search for
+ * thinkTime instead
+ * playouts - the fixed number of playouts each Monte Carlo thread runs,
+ * or 0 to run them for thinkTime instead
+ * display - display the board every display moves, or only at the end of
+ * the game (DISPLAY_FINAL), or never (DISPLAY_NONE)
+ * large - stream the savefile into the board row by row and never keep its
+ * text, for boards too large to hold more than once
+ * solveEmpties - solve the endgame exactly once this many or fewer interior
+ * positions are empty, or never if 0
+ * book - the opening book search players look their moves up in first
+ * */
+typedef struct {
+    int thinkTime;
+    int tableSize;
+    int threads;
+    int searchDepth;
+    int playouts;
+    int display;
+    bool large;
+    int solveEmpties;
+    Book book;
+} Options;
+
+/* Represents the text of the board as it is displayed and saved, held in
+ * one buffer of rows lines, each of columns * 2 characters and a newline
+ * The text starts out as it was in the savefile; after a move it is stale
+ * until it is next rendered from the positions, which only happens when it
+ * is displayed or saved
+ * */
+typedef struct {
+    char* text;
+    size_t length;
+    bool stale;
+} BoardText;
+
+/* A text savefile being read a line at a time, as in large-board mode
+ * line - the current line, in a buffer of capacity bytes reused for each
+ * ended - whether a null character has ended the savefile's contents
+ * */
+typedef struct {
+    FILE* file;
+    char* line;
+    size_t capacity;
+    bool ended;
+} SavefileStream;
+
+/* Represents every position on the board as a set of packed bit planes
+ * Each plane holds one bit per position, with each row padded out to
+ * rowWords words so that bit c of a row is the position in column c
+ * A position in none of the O, X or empty planes is blank (a corner)
+ * Scores are kept in a dense plane of one byte per position
+ *
+ * The empty plane is also kept transposed in emptyColumnPlane (columnWords
+ * words per column, bit r of a column is the position in row r), along with
+ * the number of empty positions in each row and column and the empty
+ * position nearest each edge, so that a push can be checked without
+ * walking its line:
+ * rowFirstEmpty - the first empty column after column 0 (columns if none)
+ * rowLastEmpty - the last empty column before the last column (-1 if none)
+ * columnFirstEmpty and columnLastEmpty hold the same for each column
+ * interiorEmpties counts the empty positions off the edges of the board, so
+ * the end of the game is found without looking at the board
+ * */
+typedef struct {
+    int rows;
+    int columns;
+    int rowWords;
+    int columnWords;
+    uint64_t* oPlane;
+    uint64_t* xPlane;
+    uint64_t* emptyPlane;
+    uint64_t* emptyColumnPlane;
+    unsigned char* scores;
+    int* rowEmpties;
+    int* columnEmpties;
+    int* rowFirstEmpty;
+    int* rowLastEmpty;
+    int* columnFirstEmpty;
+    int* columnLastEmpty;
+    int interiorEmpties;
+} Positions;
+
+/* A list of the legal moves in a position, each stored as the index
+ * (row * columns + column) of the position to play
+ * The first edgeCount moves are pushes, the rest are interior placements
+ * */
+typedef struct {
+    int* moves;
+    int count;
+    int edgeCount;
+    int capacity;
+} MoveList;
+
+/* Represents the state of a game in progress
+ * Running totals of each player's score are kept up to date by every
+ * placement and push, so reading a score never rescans the board
+ * The hash is the Zobrist key of the stones on the board (the XOR of
+ * zobrist_key for every stone), kept up to date in the same way
+ * scoreKey is the checksum of the board's scores and dimensions, which
+ * never change during a game, so it is worked out once when the game is
+ * set up
+ * */
+typedef struct {
+    Positions* positions;
+    int oScore;
+    int xScore;
+    uint64_t hash;
+    uint64_t scoreKey;
+    MoveList moves;
+} GameState;
+
+/* Records what a move changed so that it can be undone
+ * The stones displaced by a push all sit in one line next to the edge
+ * position, so only the position the line was pushed into (shiftIndex, a
+ * row or column index) is needed to shift them back; it is -1 for a
+ * placement on the interior
+ * */
+typedef struct {
+    int row;
+    int column;
+    int shiftIndex;
+    int oScore;
+    int xScore;
+    uint64_t hash;
+} MoveRecord;
+
+/* A move along with the key it is ordered by during a search */
+typedef struct {
+    int move;
+    int key;
+} ScoredMove;
+
+/* An entry in the transposition table
+ * data holds the value of the position (low 32 bits) and its best move
+ * (high 32 bits); lock holds the key XORed with data, with its lowest
+ * ENTRY_INFO_BITS bits replaced by the bound (2 bits), depth (8 bits) and
+ * age (6 bits) of the entry
+ * Both words are read and written separately without locking, so an entry
+ * torn by a write from another search fails the key check and is ignored
+ * */
+typedef struct {
+    uint64_t lock;
+    uint64_t data;
+} TableEntry;
+
+/* A fixed size table of searched positions, indexed by the low bits of
+ * their key; it has a power of two number of entries, so mask selects them
+ * */
+typedef struct {
+    TableEntry* entries;
+    uint64_t mask;
+    int age;
+} TranspositionTable;
+
+/* What the transposition table holds for a position */
+typedef struct {
+    int value;
+    int move;
+    int depth;
+    int bound;
+} TableHit;
+
+/* Represents the engine behind the search players, which keeps its
+ * transposition table between moves so later searches reuse earlier work
+ * The table is allocated by the first search
+ * seed varies the random playouts of the Monte Carlo player between games,
+ * which also totals its playouts and the time spent on them (ms)
+ * If reportMoves is set the playouts of each Monte Carlo move, and the
+ * margin of each solved endgame, are reported on stderr
+ * solveFailed is the number of empty positions left when an endgame solve
+ * last ran out of time or nodes, or 0
+ * ponderMove is the move found by pondering for the position the search
+ * player is next to move in, or -1
+ * arenas holds the scratch memory of each thread a move is chosen with
+ * (options->threads of them, the first also the main thread's), reset once
+ * the move is chosen, followed by one for pondering
+ * */
+typedef struct {
+    Options* options;
+    TranspositionTable table;
+    int seed;
+    bool reportMoves;
+    int solveFailed;
+    int ponderMove;
+    Arena* arenas;
+    long playouts;
+    double playoutTime;
+} Engine;
+
+/* Represents a single search for the best move for one player
+ * Each ply has its own move list and ordering buffer, taken from the
+ * search's arena the first time the search reaches that ply, so nodes never
+ * allocate memory
+ * The search stops as soon as the clock passes the deadline, it has
+ * visited nodeLimit nodes (if that is not 0) or another thread sets
+ * finished; another thread may also move the deadline while it runs
+ * Iterative deepening starts at startDepth, and the best move of the
+ * deepest completed iteration is kept in bestMove
+ * */
+typedef struct {
+    GameState* game;
+    TranspositionTable* table;
+    MoveList plyMoves[MAX_SEARCH_DEPTH + 1];
+    ScoredMove* plyOrder[MAX_SEARCH_DEPTH + 1];
+    Arena* arena;
+    double deadline;
+    bool* finished;
+    long nodes;
+    long nodeLimit;
+    bool stopped;
+    int startDepth;
+    int completedDepth;
+    int bestMove;
+} Search;
+
+/* A helper thread searching its own copy of the game
+ * */
+typedef struct {
+    pthread_t thread;
+    bool started;
+    GameState game;
+    Search search;
+    char player;
+    int maxDepth;
+} SearchThread;
+
+/* A search player's reply searched on its opponent's time, by a thread of
+ * its own, while a human player chooses their move
+ * The thread predicts the human's move (the move the transposition table
+ * holds for them, or else the first in the move ordering), plays it on its
+ * copy of the game and searches the reply with no deadline in the engine's
+ * table; once that search starts predicted is set, with the hash of the
+ * predicted position in predictedHash
+ * engine is the engine of the search player
+ * If the human plays the predicted move the search is given the rest of
+ * the think time from start and its move is played; otherwise it is
+ * stopped through finished, leaving what it found in the table
+ * */
+typedef struct {
+    SearchThread thread;
+    bool finished;
+    bool predicted;
+    uint64_t predictedHash;
+    double start;
+    Engine* engine;
+} Ponder;
+
+/* Represents a batch of self-play games shared out between worker threads
+ * Game g is played from savefile g % fileCount, whose positions and player
+ * to move are loaded up front; each worker takes the next game to play
+ * from nextGame
+ * */
+typedef struct {
+    Positions** positions;
+    char* players;
+    int fileCount;
+    int games;
+    int nextGame;
+    char oType;
+    char xType;
+    Options* options;
+} Batch;
+
+/* A worker thread of a batch, with the results of the games it played
+ * margin totals player O's score minus player X's, and winningMargin the
+ * winner's score minus the loser's
+ * */
+typedef struct {
+    pthread_t thread;
+    bool started;
+    Batch* batch;
+    long oWins;
+    long xWins;
+    long ties;
+    long long margin;
+    long long winningMargin;
+    long playouts;
+    double playoutTime;
+} BatchWorker;
+
+/* The result of checking one savefile in bulk validation
+ * status is the exit status push2310 would give for the savefile (LOAD_OK,
+ * LOAD_INVALID, LOAD_FULL, or 3 if it cannot be opened), and the rest are
+ * only set if its board loaded
+ * moves is the number of legal moves for the player to move
+ * */
+typedef struct {
+    char* path;
+    int status;
+    char player;
+    int rows;
+    int columns;
+    int oScore;
+    int xScore;
+    int moves;
+} FileCheck;
+
+/* A list of savefiles checked by a pool of threads, each of which takes
+ * the next file to check from next
+ * */
+typedef struct {
+    FileCheck* checks;
+    int count;
+    int next;
+} Validation;
+
+/* A count of the positions reachable from a game in depth moves, shared
+ * between worker threads which each take the next root move to count
+ * from nextMove
+ * counts holds the number of positions below each root move
+ * */
+typedef struct {
+    GameState* game;
+    char player;
+    int depth;
+    MoveList rootMoves;
+    long long* counts;
+    int nextMove;
+} Perft;
+
+/* A worker thread of a perft count
+ * */
+typedef struct {
+    pthread_t thread;
+    bool started;
+    Perft* perft;
+} PerftWorker;
+
+/* A game played through the engine protocol, kept from one command to the
+ * next along with the engine (and so its transposition table) which chooses
+ * the moves of the given player type
+ * The game is only set up once loaded is set; thinkTime is the think time a
+ * go command without one of its own uses
+ * scoreKey is the scoreKey of the last game set up, as the values in the
+ * table depend on the board's scores and dimensions; the table is only
+ * cleared when a position is set on a different board, so it stays warm
+ * through a game
+ * The game is allocated from arenas[0]; a position is loaded into
+ * arenas[1], which is swapped in once the savefile proves valid, so a
+ * failed load leaves the game as it was and a session which has loaded a
+ * board before loads another of its size without allocating
+ * */
+typedef struct {
+    Options options;
+    Engine engine;
+    Arena arenas[2];
+    GameState game;
+    bool loaded;
+    char player;
+    char type;
+    int thinkTime;
+    uint64_t scoreKey;
+} EngineSession;
+
+/* A connection to the game server, playing one game through the engine
+ * protocol
+ * Input is read into input until it holds a whole line, which a worker
+ * carries out while busy is set (the line is the first lineLength bytes of
+ * input); its reply waits in output until the client takes it, and no
+ * other line is carried out until it has
+ * ended is set once the client has sent all it will, and quit once it has
+ * asked to stop; events is what the event loop is watching the connection
+ * for (nothing if it is not in the epoll set)
+ * next links the connection into the server's queues and free list; closed
+ * connections are kept on the free list with their engine's transposition
+ * table, so a later connection needs no memory allocating
+ * */
+typedef struct ServerConnection {
+    EngineSession session;
+    int fd;
+    char input[SERVER_INPUT];
+    size_t inputLength;
+    size_t lineLength;
+    char reply[REPLY_LENGTH];
+    char output[REPLY_LENGTH + 1];
+    size_t outputLength;
+    bool busy;
+    bool ended;
+    bool quit;
+    uint32_t events;
+    struct ServerConnection* next;
+} ServerConnection;
+
+/* A game server hosting many games, one for each connection to its Unix
+ * domain socket, with an event loop reading and writing every connection
+ * and a pool of workers carrying out their commands
+ * wakeup is an eventfd the workers signal once they have finished a line
+ * ready is the queue (ending at readyTail) of connections with a line for
+ * the workers, and done holds the connections whose line they finished;
+ * both are guarded by lock, with work signalled when ready is added to
+ * free holds closed connections for reuse, and slabs the slabCount blocks
+ * of SERVER_SLAB connections allocated so far
+ * connections counts the open connections, which are kept below
+ * connectionLimit so that each worker has a file descriptor left to load a
+ * savefile with; paused is set while the socket is not watched, as the
+ * limit was reached or accepting ran out of file descriptors
+ * */
+typedef struct {
+    Options options;
+    char type;
+    int listener;
+    int connections;
+    int connectionLimit;
+    bool paused;
+    int epoll;
+    int wakeup;
+    ServerConnection* ready;
+    ServerConnection* readyTail;
+    ServerConnection* done;
+    ServerConnection* free;
+    ServerConnection** slabs;
+    int slabCount;
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+} Server;
+
+#ifdef BENCH
+/* A board used to benchmark the rules kernels, with the text of its
+ * savefile and the edge positions each kernel cycles through
+ * pushes holds the edge positions (as indexes) which are valid pushes,
+ * in pushCounts[side] for each side of the board (top, bottom, left and
+ * right), and edges every edge position other than the corners
+ * */
+typedef struct {
+    GameState game;
+    char player;
+    char* text;
+    size_t length;
+    int* pushes[4];
+    int pushCounts[4];
+    int* edges;
+    int edgeCount;
+    long long sink;
+} BenchBoard;
+
+/* A kernel timed by the benchmarks, which runs ops operations on a board
+ * */
+typedef struct {
+    char* name;
+    void (*run)(BenchBoard* board, long long ops);
+} BenchKernel;
+#endif
+
+#ifdef STATS
+/* The calls made to one instrumented function, and the processor cycles
+ * spent in them */
+typedef struct {
+    long long calls;
+    long long cycles;
+} CallStats;
+
+/* The time (ms) an automated player spent choosing one move, the search
+ * nodes and playouts it visited and the bytes it allocated */
+typedef struct {
+    char player;
+    double time;
+    long long nodes;
+    long long bytes;
+} MoveStats;
+
+/* Everything counted in a stats build, across every thread
+ * Counters are added to atomically; the list of moves (moveCount of them,
+ * growing as moves are made) is guarded by lock
+ * */
+typedef struct {
+    CallStats calls[STAT_KINDS];
+    long long nodes;
+    long long allocations;
+    long long allocatedBytes;
+    MoveStats* moves;
+    int moveCount;
+    pthread_mutex_t lock;
+} Stats;
+#endif
+
+/* Represents a node of a Monte Carlo search tree, reached by playing move
+ * from its parent
+ * The children of a node are stored together, starting at firstChild (-1
+ * until the node is expanded)
+ * wins counts the playouts through the node won by the player who played
+ * move, with a tie counting as half a win
+ * */
+typedef struct {
+    int move;
+    int firstChild;
+    int childCount;
+    int visits;
+    double wins;
+} TreeNode;
+
+/* Represents one thread's Monte Carlo tree search of its own copy of the
+ * game, for the given player
+ * Nodes come from a pool of nodeLimit nodes allocated with the tree, as do
+ * the path, undo records and move list a playout needs, so playouts never
+ * allocate memory; once the pool is full leaves are no longer expanded
+ * The search runs playoutLimit playouts, or until the deadline if that is 0
+ * */
+typedef struct {
+    pthread_t thread;
+    bool started;
+    GameState game;
+    char player;
+    TreeNode* nodes;
+    int nodeCount;
+    int nodeLimit;
+    int* path;
+    MoveRecord* records;
+    MoveList moves;
+    uint64_t random;
+    double deadline;
+    long playoutLimit;
+    long playouts;
+} PlayoutTree;
+
+/* A kernel adding up the scores of the positions between first and last
+ * (inclusive) whose bits are set in words, where scores holds length
+ * scores
+ * */
+typedef int (*MaskedSum)(uint64_t* words, unsigned char* scores, int first,
+	int last, size_t length);
+
+int parse_options(int argc, char** argv, Options* options);
+bool parse_number(char* text, int* number);
+bool parse_display(char* text, int* display);
+void check_arguments(char pOType, char pXType, FILE* saveFile);
+bool valid_player_type(char type);
+void read_savefile(FILE* saveFile, char pOType, char pXType,
+	Options* options);
+int load_savefile(int fd, Positions** pPositions, char* pCurrentPlayer,
+	BoardText* text, Arena* arena);
+char* read_file(int fd, size_t* length, Arena* arena);
+int stream_savefile(FILE* saveFile, Positions** pPositions,
+	char* pCurrentPlayer);
+int stream_rows(SavefileStream* stream, off_t size, Positions** pPositions,
+	char* pCurrentPlayer);
+bool stream_line(SavefileStream* stream, size_t* length);
+void report_peak_memory(void);
+int parse_savefile(char* data, size_t length, Positions** pPositions,
+	char* pCurrentPlayer, BoardText* text, Arena* arena);
+bool next_line(char** position, char* end, char** line, size_t* length);
+bool parse_dimensions(char* line, size_t length, int* rows, int* columns);
+bool parse_int(char** text, char* end, int* number);
+bool parse_row(Positions* positions, int row, char* line,
+	bool* blankCorner);
+void exit_load_error(int status);
+int parse_binary_savefile(unsigned char* data, size_t length,
+	Positions** pPositions, char* pCurrentPlayer, BoardText* text,
+	Arena* arena);
+bool decode_row(Positions* positions, int row, unsigned char* stones,
+	unsigned char* scores, uint64_t size, bool* blankCorner);
+void encode_row(Positions* positions, int row, unsigned char* stones,
+	unsigned char* scores, uint64_t size);
+uint64_t read_bits(unsigned char* data, size_t length, uint64_t bit);
+void or_bits(unsigned char* data, size_t length, uint64_t bit,
+	uint64_t value);
+uint64_t pack_even_bits(uint64_t bits);
+uint64_t spread_bits(uint64_t bits);
+uint64_t pack_nibbles(uint64_t bytes);
+uint64_t spread_nibbles(uint64_t nibbles);
+uint64_t low_mask(int count);
+uint64_t binary_checksum(unsigned char* data, size_t length);
+uint64_t read_little_endian(unsigned char* data, int bytes);
+void write_little_endian(unsigned char* data, uint64_t value, int bytes);
+int convert_main(int argc, char** argv);
+void init_engine(Engine* engine, Options* options);
+void free_engine(Engine* engine);
+int batch_main(int argc, char** argv, Options* options);
+void load_batch(Batch* batch, char* path);
+void add_batch_file(Batch* batch, char* fileName);
+int compare_names(const void* first, const void* second);
+void* run_batch_worker(void* batchWorker);
+void report_batch(BatchWorker* workers, int count, int games,
+	double elapsed);
+void list_savefiles(char* path, char*** names, int* count);
+int validate_main(int argc, char** argv, Options* options);
+void* run_validation(void* validation);
+void check_file(FileCheck* check);
+void report_check(FileCheck* check);
+int perft_main(int argc, char** argv, Options* options);
+void* run_perft_worker(void* perftWorker);
+long long perft(GameState* game, MoveList* plyMoves, int depth, char player);
+int book_main(int argc, char** argv, Options* options);
+void add_book_line(GameState* game, char player, int plies,
+	Engine* engine, BookEntry** entries, int* count);
+bool write_book(BookEntry* entries, int count, char* fileName);
+bool open_book(Book* book, char* fileName);
+bool probe_book(Book* book, GameState* game, char player, int* move);
+uint64_t book_key(GameState* game, char player);
+int engine_main(int argc, char** argv, Options* options);
+void init_session(EngineSession* session, Options* options, char type);
+void free_session(EngineSession* session);
+bool engine_command(EngineSession* session, char* line, char* reply);
+void session_position(EngineSession* session, char* fileName, char* reply);
+void session_move(EngineSession* session, char* arguments, char* reply);
+void session_go(EngineSession* session, char* arguments, char* reply);
+int serve_main(int argc, char** argv, Options* options);
+bool open_listener(Server* server, char* path);
+void accept_connections(Server* server);
+void watch_listener(Server* server, bool watch);
+int connection_limit(Server* server, int workers);
+ServerConnection* new_connection(Server* server);
+void close_connection(Server* server, ServerConnection* connection);
+void read_connection(Server* server, ServerConnection* connection);
+void advance_connection(Server* server, ServerConnection* connection);
+bool flush_connection(ServerConnection* connection);
+void watch_connection(Server* server, ServerConnection* connection);
+void finish_lines(Server* server);
+void* run_server_worker(void* server);
+void init_table(TranspositionTable* table, int megabytes);
+void free_table(TranspositionTable* table);
+void clear_table(TranspositionTable* table);
+bool probe_table(TranspositionTable* table, uint64_t key, TableHit* hit);
+void store_table(TranspositionTable* table, uint64_t key, int depth,
+	int bound, int value, int move);
+uint64_t zobrist_key(int index, char stone);
+uint64_t position_key(GameState* game, char player);
+void init_arena(Arena* arena);
+void* arena_alloc(Arena* arena, size_t size);
+void* arena_calloc(Arena* arena, size_t count, size_t size);
+void* arena_grow(Arena* arena, void* data, size_t size, size_t newSize);
+void reset_arena(Arena* arena);
+void free_arena(Arena* arena);
+Positions* allocate_positions(int rows, int columns, Arena* arena);
+Positions* copy_positions(Positions* positions, Arena* arena);
+void free_positions(Positions* positions);
+void initialise_game(GameState* game, Positions* positions, Arena* arena);
+void render_board(BoardText* text, Positions* positions);
+void render_rows(Positions* positions, int firstRow, int lastRow,
+	char* out);
+bool write_board(Positions* positions, FILE* out);
+void display_board(BoardText* text, Positions* positions);
+void write_all(int fd, char* data, size_t length);
+void play_game(BoardText* text, GameState* game, char pOType, char pXType,
+	char* currentPlayer, Engine* engine);
+void automated_o_move(GameState* game, char pOType, char* currentPlayer,
+	Engine* engine);
+void automated_x_move(GameState* game, char pXType, char* currentPlayer,
+	Engine* engine);
+int automated_move(GameState* game, char type, char player, Engine* engine);
+int type0(GameState* game, char player);
+int* type1(GameState* game, char* currentPlayer, Arena* arena);
+int search_move(GameState* game, char player, Engine* engine);
+bool solve_endgame(GameState* game, char player, Engine* engine, int* move,
+	int* margin);
+int solve(Search* search, int alpha, int beta, char player, int ply);
+void init_search(Search* search, GameState* game, Engine* engine,
+	bool* finished, int startDepth, Arena* arena);
+void* run_helper(void* helper);
+void start_ponder(Ponder* ponder, GameState* game, char player, char type,
+	Engine* engine);
+void* run_ponder(void* ponder);
+void finish_ponder(Ponder* ponder, GameState* game, Engine* engine);
+void iterate_search(Search* search, char player, int maxDepth);
+void copy_game(GameState* copy, GameState* game, Arena* arena);
+int mcts_move(GameState* game, char player, Engine* engine);
+void init_playout_tree(PlayoutTree* tree, GameState* game, char player,
+	Options* options, int nodeLimit, int seed, Arena* arena);
+void* run_playouts(void* playoutTree);
+void run_playout(PlayoutTree* tree);
+bool expand_node(PlayoutTree* tree, int node);
+int select_child(PlayoutTree* tree, int node);
+uint64_t next_random(uint64_t* state);
+void free_game(GameState* game);
+int negamax(Search* search, int depth, int alpha, int beta, char player,
+	int ply);
+void promote_move(ScoredMove* order, int count, int move);
+bool out_of_time(Search* search);
+void prepare_ply(Search* search, int ply);
+void order_moves(Search* search, MoveList* moves, ScoredMove* order,
+	char player);
+int compare_scored_moves(const void* first, const void* second);
+int evaluate(GameState* game, char player);
+char other_player(char player);
+int count_empty(Positions* positions);
+double now_ms(void);
+void human_o_move(BoardText* text, GameState* game, char* currentPlayer,
+	Arena* arena);
+void human_x_move(BoardText* text, GameState* game, char* currentPlayer,
+	Arena* arena);
+bool valid_position(int chosenRow, int chosenColumn, Positions* positions);
+bool outer_position(int chosenRow, int chosenColumn, int rows, int columns);
+bool valid_push(int chosenRow, int chosenColumn, Positions* positions);
+uint64_t* plane_row(Positions* positions, uint64_t* plane, int row);
+uint64_t column_mask(int word, int firstColumn, int lastColumn);
+bool test_position(Positions* positions, uint64_t* plane, int row,
+	int column);
+void set_position(Positions* positions, uint64_t* plane, int row, int column,
+	bool value);
+char get_stone(Positions* positions, int row, int column);
+void set_stone(Positions* positions, int row, int column, char stone);
+void set_empty(Positions* positions, int row, int column, bool empty);
+int first_set_bit(uint64_t* words, int first, int last);
+int last_set_bit(uint64_t* words, int first, int last);
+int first_empty_in_row(Positions* positions, int row, int firstColumn,
+	int lastColumn);
+int last_empty_in_row(Positions* positions, int row, int firstColumn,
+	int lastColumn);
+int first_empty_in_column(Positions* positions, int column, int firstRow,
+	int lastRow);
+int last_empty_in_column(Positions* positions, int column, int firstRow,
+	int lastRow);
+void shift_row_up(uint64_t* row, int firstColumn, int lastColumn);
+void shift_row_down(uint64_t* row, int rowWords, int firstColumn,
+	int lastColumn);
+void move_column_stone(Positions* positions, int column, int fromRow,
+	int toRow);
+int row_score(Positions* positions, uint64_t* plane, int row,
+	int firstColumn, int lastColumn);
+int column_score(Positions* positions, uint64_t* plane, int column,
+	int firstRow, int lastRow);
+int plane_score(Positions* positions, uint64_t* plane);
+void choose_masked_sum(void);
+int masked_sum_scalar(uint64_t* words, unsigned char* scores, int first,
+	int last, size_t length);
+#ifdef SIMD_X86
+int masked_sum_sse2(uint64_t* words, unsigned char* scores, int first,
+	int last, size_t length);
+int masked_sum_avx2(uint64_t* words, unsigned char* scores, int first,
+	int last, size_t length);
+#endif
+uint64_t row_hash(Positions* positions, uint64_t* plane, int row,
+	int firstColumn, int lastColumn, char stone);
+uint64_t column_hash(Positions* positions, uint64_t* plane, int column,
+	int firstRow, int lastRow, char stone);
+uint64_t plane_hash(Positions* positions, uint64_t* plane, char stone);
+void account_row(GameState* game, int row, int firstColumn, int lastColumn,
+	int sign);
+void account_column(GameState* game, int column, int firstRow, int lastRow,
+	int sign);
+void place_stone(GameState* game, int row, int column, char stone);
+int get_o_score(GameState* game);
+int get_x_score(GameState* game);
+bool decrease_score(GameState* game, int chosenRow, int chosenColumn,
+	char* currentPlayer);
+void apply_move(GameState* game, int chosenRow, int chosenColumn, char stone,
+	MoveRecord* move);
+void undo_move(GameState* game, MoveRecord* move);
+int push_stones(int chosenRow, int chosenColumn, GameState* game,
+	char* currentPlayer);
+int downward_push(GameState* game, int chosenColumn, char* currentPlayer);
+int left_push(GameState* game, int chosenRow, char* currentPlayer);
+int right_push(GameState* game, int chosenRow, char* currentPlayer);
+int upward_push(GameState* game, int chosenColumn, char* currentPlayer);
+void init_move_list(MoveList* moves, Positions* positions, Arena* arena);
+void free_move_list(MoveList* moves);
+void generate_moves(GameState* game, MoveList* moves);
+void add_edge_move(Positions* positions, MoveList* moves, int row,
+	int column);
+bool game_over(Positions* positions);
+void display_winners(GameState* game);
+bool save_game(BoardText* text, Positions* positions, char* fileName,
+	char* currentPlayer);
+bool save_binary(Positions* positions, char* fileName, char currentPlayer);
+
+/* The row scoring kernel, chosen by choose_masked_sum at startup */
+MaskedSum maskedSum = masked_sum_scalar;
+
+#ifdef STATS
+uint64_t read_cycles(void);
+void record_call(int kind, uint64_t start);
+void record_move(char player, double start, long long nodes,
+	long long bytes);
+void print_stats(void);
+void* stats_malloc(size_t size);
+void* stats_calloc(size_t count, size_t size);
+void* stats_realloc(void* pointer, size_t size);
+
+/* The counters of a stats build, and the names of the timed functions */
+Stats stats = {.lock = PTHREAD_MUTEX_INITIALIZER};
+const char* statNames[STAT_KINDS] = {"valid_position", "valid_push",
+	"push_stones", "decrease_score", "row_score", "column_score",
+	"plane_score"};
+#endif
+#ifdef BENCH
+int bench_main(int argc, char** argv);
+bool make_bench_board(BenchBoard* board, int size, int density);
+void free_bench_board(BenchBoard* board);
+double time_kernel(BenchKernel* kernel, BenchBoard* board, long long* ops);
+int compare_times(const void* first, const void* second);
+void bench_push_down(BenchBoard* board, long long ops);
+void bench_push_up(BenchBoard* board, long long ops);
+void bench_push_right(BenchBoard* board, long long ops);
+void bench_push_left(BenchBoard* board, long long ops);
+void bench_pushes(BenchBoard* board, int side, long long ops);
+void bench_valid_push(BenchBoard* board, long long ops);
+void bench_valid_position(BenchBoard* board, long long ops);
+void bench_plane_score(BenchBoard* board, long long ops);
+void bench_game_over(BenchBoard* board, long long ops);
+void bench_decrease_score(BenchBoard* board, long long ops);
+void bench_parse_savefile(BenchBoard* board, long long ops);
+
+int main(int argc, char** argv) {
+    choose_masked_sum();
+    return bench_main(argc, argv);
+}
+#else
+
+int main(int argc, char** argv) {
+    Options options;
+    int first;
+
+    choose_masked_sum();
+    first = parse_options(argc, argv, &options);
+
+    if (first >= 0 && first < argc && strcmp(argv[first], "batch") == 0) {
+        return batch_main(argc - first - 1, argv + first + 1, &options);
+    }
+    if (first >= 0 && first < argc && strcmp(argv[first], "convert") == 0) {
+        return convert_main(argc - first - 1, argv + first + 1);
+    }
+    if (first >= 0 && first < argc && strcmp(argv[first], "validate") == 0) {
+        return validate_main(argc - first - 1, argv + first + 1, &options);
+    }
+    if (first >= 0 && first < argc && strcmp(argv[first], "perft") == 0) {
+        return perft_main(argc - first - 1, argv + first + 1, &options);
+    }
+    if (first >= 0 && first < argc && strcmp(argv[first], "book") == 0) {
+        return book_main(argc - first - 1, argv + first + 1, &options);
+    }
+    if (first >= 0 && first < argc && strcmp(argv[first], "engine") == 0) {
+        return engine_main(argc - first - 1, argv + first + 1, &options);
+    }
+    if (first >= 0 && first < argc && strcmp(argv[first], "serve") == 0) {
+        return serve_main(argc - first - 1, argv + first + 1, &options);
+    }
+
+    /* Check the number of arguments */
+    if (first < 0 || argc - first != 3) {
+        fprintf(stderr, "Usage: push2310 typeO typeX fname\n");
+        exit(1);
+    }
+
+    char pOType, pXType;
+    pOType = argv[first][0];
+    pXType = argv[first + 1][0];
+    FILE* saveFile = fopen(argv[first + 2], "r");
+
+    check_arguments(pOType, pXType, saveFile);
+
+    read_savefile(saveFile, pOType, pXType, &options);
+
+    return 0;
+}
+#endif
+
+/* Read the options given before the player types, filling in defaults for
+ * any that are not given
+ * -t ms  time each search player may spend choosing a move
+ * -m mb  memory given to the search players' transposition table
+ * -j n   threads each search player searches with
+ * -d n   search exactly n moves ahead on one thread, ignoring -t and -j
+ * -n n   run exactly n playouts on each Monte Carlo thread, ignoring -t
+ * -o mode  display the board after every move (all, the default), every n
+ *        moves (a number), only at the end (final) or never (none); moves
+ *        made by automated players are only listed when boards are shown
+ *        during the game
+ * -e n   search players solve the endgame exactly once n or fewer interior
+ *        positions are empty (0 never solves it)
+ * -b file  search players play the moves in the opening book file (built
+ *        by the book subcommand) while it has them
+ * -l     large-board mode: load the savefile a row at a time without
+ *        keeping its text, and report the peak memory used on exit
+ * Return the index of the first argument after the options, or -1 if an
+ * option is invalid
+ * */
+int parse_options(int argc, char** argv, Options* options) {
+    int i = 1;
+
+    options->thinkTime = DEFAULT_THINK_TIME;
+    options->tableSize = DEFAULT_TABLE_SIZE;
+    options->threads = 1;
+    options->searchDepth = 0;
+    options->playouts = 0;
+    options->display = 1;
+    options->large = false;
+    options->solveEmpties = DEFAULT_SOLVE_EMPTIES;
+    options->book.data = NULL;
+
+    while (i < argc && argv[i][0] == '-' && argv[i][1] != '\0') {
+        if (strcmp(argv[i], "-l") == 0) {
+            options->large = true;
+            i++;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            return -1;
+        }
+
+        if (strcmp(argv[i], "-t") == 0) {
+            if (!parse_number(argv[i + 1], &options->thinkTime) ||
+		    options->thinkTime < 1) {
+                return -1;
+            }
+        } else if (strcmp(argv[i], "-m") == 0) {
+            if (!parse_number(argv[i + 1], &options->tableSize) ||
+		    options->tableSize < 1) {
+                return -1;
+            }
+        } else if (strcmp(argv[i], "-j") == 0) {
+            if (!parse_number(argv[i + 1], &options->threads) ||
+		    options->threads < 1) {
+                return -1;
+            }
+        } else if (strcmp(argv[i], "-d") == 0) {
+            if (!parse_number(argv[i + 1], &options->searchDepth) ||
+		    options->searchDepth < 1) {
+                return -1;
+            }
+        } else if (strcmp(argv[i], "-n") == 0) {
+            if (!parse_number(argv[i + 1], &options->playouts) ||
+		    options->playouts < 1) {
+                return -1;
+            }
+        } else if (strcmp(argv[i], "-e") == 0) {
+            if (!parse_number(argv[i + 1], &options->solveEmpties)) {
+                return -1;
+            }
+        } else if (strcmp(argv[i], "-b") == 0) {
+            if (!open_book(&options->book, argv[i + 1])) {
+                return -1;
+            }
+        } else if (strcmp(argv[i], "-o") == 0) {
+            if (!parse_display(argv[i + 1], &options->display)) {
+                return -1;
+            }
+        } else {
+            return -1;
+        }
+        i += 2;
+    }
+
+    return i;
+}
+
+/* Read an output mode: all, final, none or a number of moves
+ * Return true if the text is an output mode and false otherwise
+ * */
+bool parse_display(char* text, int* display) {
+    if (strcmp(text, "all") == 0) {
+        *display = 1;
+    } else if (strcmp(text, "final") == 0) {
+        *display = DISPLAY_FINAL;
+    } else if (strcmp(text, "none") == 0) {
+        *display = DISPLAY_NONE;
+    } else if (!parse_number(text, display) || *display < 1) {
+        return false;
+    }
+
+    return true;
+}
+
+/* Read a non-negative decimal number which makes up all of the given text
+ * Return true if the text is a number and false otherwise
+ * */
+bool parse_number(char* text, int* number) {
+    char* end;
+    long value;
+
+    if (!isdigit(text[0])) {
+        return false;
+    }
+
+    value = strtol(text, &end, 10);
+    if (*end != '\0' || value > INT_MAX) {
+        return false;
+    }
+
+    *number = (int)value;
+    return true;
+}
+
+/* Ensures that the arguments given to the program
+ * Will exit if player types are invalid or if there was an error
+ * opening the specified save file */
+void check_arguments(char pOType, char pXType, FILE* saveFile) {
+    /* Check player O type */
+    if (!valid_player_type(pOType)) {
+        fprintf(stderr, "Invalid player type\n");
+        exit(2);
+    }
+
+    /* Check player X type */
+    if (!valid_player_type(pXType)) {
+        fprintf(stderr, "Invalid player type\n");
+        exit(2);
+    }
+
+    if (saveFile == 0) {
+        fprintf(stderr, "No file to load from\n");
+        exit(3);
+    }
+}
+
+/* Check that the given player type is one of the known types
+ * 0 and 1 are the simple automated players, 2 searches ahead with
+ * alpha-beta, 3 plays by Monte Carlo tree search and H is a human player
+ * Return true if the type is valid and false otherwise
+ * */
+bool valid_player_type(char type) {
+    return type == '0' || type == '1' || type == '2' || type == '3' ||
+	    type == 'H';
+}
+
+/* Set up an empty arena, which allocates its block on first use
+ * */
+void init_arena(Arena* arena) {
+    arena->block = NULL;
+    arena->size = 0;
+    arena->used = 0;
+    arena->overflow = NULL;
+    arena->overflowBytes = 0;
+}
+
+/* Allocate memory from the given arena, or from the heap if it is NULL
+ * Return the memory, aligned to ARENA_ALIGN bytes
+ * */
+void* arena_alloc(Arena* arena, size_t size) {
+    char* chunk;
+
+    if (arena == NULL) {
+        return malloc(size);
+    }
+
+    size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    if (arena->size - arena->used >= size) {
+        chunk = arena->block + arena->used;
+        arena->used += size;
+        return chunk;
+    }
+
+    chunk = (char*)malloc(ARENA_ALIGN + size);
+    *(void**)chunk = arena->overflow;
+    arena->overflow = chunk;
+    arena->overflowBytes += size;
+    return chunk + ARENA_ALIGN;
+}
+
+/* Allocate zeroed memory for count items of the given size from the given
+ * arena, or from the heap if it is NULL
+ * */
+void* arena_calloc(Arena* arena, size_t count, size_t size) {
+    void* data;
+
+    if (arena == NULL) {
+        return calloc(count, size);
+    }
+
+    data = arena_alloc(arena, count * size);
+    memset(data, 0, count * size);
+    return data;
+}
+
+/* Grow memory of the given size allocated from an arena (or the heap if it
+ * is NULL) to newSize bytes, keeping its contents
+ * In an arena the old memory is only given back when the arena is reset
+ * Return the grown memory
+ * */
+void* arena_grow(Arena* arena, void* data, size_t size, size_t newSize) {
+    void* grown;
+
+    if (arena == NULL) {
+        return realloc(data, newSize);
+    }
+
+    grown = arena_alloc(arena, newSize);
+    memcpy(grown, data, size);
+    return grown;
+}
+
+/* Give back everything allocated from an arena at once
+ * If anything overflowed the block, the overflow is freed and the block
+ * grown to hold it all next time
+ * */
+void reset_arena(Arena* arena) {
+    arena->used = 0;
+    if (arena->overflow == NULL) {
+        return;
+    }
+
+    while (arena->overflow != NULL) {
+        void* next = *(void**)arena->overflow;
+
+        free(arena->overflow);
+        arena->overflow = next;
+    }
+    free(arena->block);
+    arena->size += arena->overflowBytes;
+    arena->block = (char*)malloc(arena->size);
+    arena->overflowBytes = 0;
+}
+
+/* Free all of the memory of an arena
+ * */
+void free_arena(Arena* arena) {
+    reset_arena(arena);
+    free(arena->block);
+    init_arena(arena);
+}
+
+/* Allocate the planes for a board with the given number of rows and
+ * columns from the given arena, or from the heap if it is NULL
+ * Every position starts out blank with a score of zero
+ * Return the allocated positions
+ * */
+Positions* allocate_positions(int rows, int columns, Arena* arena) {
+    Positions* positions = (Positions*)arena_alloc(arena, sizeof(Positions));
+    size_t words;
+    int i;
+
+    positions->rows = rows;
+    positions->columns = columns;
+    positions->rowWords = (columns + PLANE_BITS - 1) / PLANE_BITS;
+    positions->columnWords = (rows + PLANE_BITS - 1) / PLANE_BITS;
+    words = (size_t)rows * positions->rowWords;
+
+    positions->oPlane = (uint64_t*)arena_calloc(arena, words,
+	    sizeof(uint64_t));
+    positions->xPlane = (uint64_t*)arena_calloc(arena, words,
+	    sizeof(uint64_t));
+    positions->emptyPlane = (uint64_t*)arena_calloc(arena, words,
+	    sizeof(uint64_t));
+    positions->emptyColumnPlane = (uint64_t*)arena_calloc(arena,
+	    (size_t)columns * positions->columnWords, sizeof(uint64_t));
+    positions->scores = (unsigned char*)arena_calloc(arena,
+	    (size_t)rows * columns, sizeof(unsigned char));
+
+    positions->rowEmpties = (int*)arena_calloc(arena, rows, sizeof(int));
+    positions->columnEmpties = (int*)arena_calloc(arena, columns,
+	    sizeof(int));
+    positions->rowFirstEmpty = (int*)arena_alloc(arena, sizeof(int) * rows);
+    positions->rowLastEmpty = (int*)arena_alloc(arena, sizeof(int) * rows);
+    positions->columnFirstEmpty = (int*)arena_alloc(arena,
+	    sizeof(int) * columns);
+    positions->columnLastEmpty = (int*)arena_alloc(arena,
+	    sizeof(int) * columns);
+    positions->interiorEmpties = 0;
+
+    for (i = 0; i < rows; i++) {
+        positions->rowFirstEmpty[i] = columns;
+        positions->rowLastEmpty[i] = -1;
+    }
+    for (i = 0; i < columns; i++) {
+        positions->columnFirstEmpty[i] = rows;
+        positions->columnLastEmpty[i] = -1;
+    }
+
+    return positions;
+}
+
+/* Make an independent copy of the given positions in the given arena, or on
+ * the heap if it is NULL
+ * Return the copy
+ * */
+Positions* copy_positions(Positions* positions, Arena* arena) {
+    int rows = positions->rows, columns = positions->columns;
+    Positions* copy = allocate_positions(rows, columns, arena);
+    size_t words = (size_t)rows * positions->rowWords;
+
+    memcpy(copy->oPlane, positions->oPlane, sizeof(uint64_t) * words);
+    memcpy(copy->xPlane, positions->xPlane, sizeof(uint64_t) * words);
+    memcpy(copy->emptyPlane, positions->emptyPlane, sizeof(uint64_t) * words);
+    memcpy(copy->emptyColumnPlane, positions->emptyColumnPlane,
+	    sizeof(uint64_t) * columns * positions->columnWords);
+    memcpy(copy->scores, positions->scores, (size_t)rows * columns);
+
+    memcpy(copy->rowEmpties, positions->rowEmpties, sizeof(int) * rows);
+    memcpy(copy->columnEmpties, positions->columnEmpties,
+	    sizeof(int) * columns);
+    memcpy(copy->rowFirstEmpty, positions->rowFirstEmpty, sizeof(int) * rows);
+    memcpy(copy->rowLastEmpty, positions->rowLastEmpty, sizeof(int) * rows);
+    memcpy(copy->columnFirstEmpty, positions->columnFirstEmpty,
+	    sizeof(int) * columns);
+    memcpy(copy->columnLastEmpty, positions->columnLastEmpty,
+	    sizeof(int) * columns);
+
+    copy->interiorEmpties = positions->interiorEmpties;
+
+    return copy;
+}
+
+/* Free the planes of the given positions, if they are on the heap
+ * */
+void free_positions(Positions* positions) {
+    free(positions->oPlane);
+    free(positions->xPlane);
+    free(positions->emptyPlane);
+    free(positions->emptyColumnPlane);
+    free(positions->scores);
+    free(positions->rowEmpties);
+    free(positions->columnEmpties);
+    free(positions->rowFirstEmpty);
+    free(positions->rowLastEmpty);
+    free(positions->columnFirstEmpty);
+    free(positions->columnLastEmpty);
+    free(positions);
+}
+
+/* Load the game in the savefile and play it out
+ * In large-board mode the savefile is streamed into the board and its text
+ * is not kept, so the board is rendered afresh whenever it is shown
+ * Exit if the savefile is invalid or its board is already full
+ * */
+void read_savefile(FILE* saveFile, char pOType, char pXType,
+	Options* options) {
+    Positions* positions;
+    char currentPlayer;
+    GameState game;
+    Engine engine;
+    BoardText text;
+    int status;
+
+    if (options->large) {
+        text.text = NULL;
+        text.length = 0;
+        text.stale = true;
+        status = stream_savefile(saveFile, &positions, &currentPlayer);
+    } else {
+        status = load_savefile(fileno(saveFile), &positions, &currentPlayer,
+		&text, NULL);
+    }
+
+    fclose(saveFile);
+    if (status != LOAD_OK) {
+        exit_load_error(status);
+    }
+
+    initialise_game(&game, positions, NULL);
+    init_engine(&engine, options);
+    if (options->display > 0) {
+        display_board(&text, positions);
+    }
+    play_game(&text, &game, pOType, pXType, &currentPlayer, &engine);
+    free_engine(&engine);
+    if (options->large) {
+        report_peak_memory();
+    }
+}
+
+/* Load the savefile open on the given file descriptor, mapping it into
+ * memory (or reading it in if it cannot be mapped, such as from a pipe)
+ * Both text and binary savefiles are loaded, told apart by BINARY_MAGIC
+ * The positions on the board are given back in pPositions, the player to
+ * move in pCurrentPlayer and, if text is not NULL, the board as it appears
+ * in the savefile in text
+ * The positions (and anything read in) come from the given arena, or the
+ * heap if it is NULL
+ * Return LOAD_OK if the savefile is valid, LOAD_FULL if it is valid but its
+ * board is full (the positions are still given back) or LOAD_INVALID
+ * */
+int load_savefile(int fd, Positions** pPositions, char* pCurrentPlayer,
+	BoardText* text, Arena* arena) {
+    struct stat info;
+    size_t length;
+    char* data;
+    int status;
+
+    if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0) {
+        data = (char*)mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+            posix_madvise(data, info.st_size, POSIX_MADV_SEQUENTIAL);
+            status = parse_savefile(data, info.st_size, pPositions,
+		    pCurrentPlayer, text, arena);
+            munmap(data, info.st_size);
+            return status;
+        }
+    }
+
+    data = read_file(fd, &length, arena);
+    if (data == NULL) {
+        *pPositions = NULL;
+        return LOAD_INVALID;
+    }
+    status = parse_savefile(data, length, pPositions, pCurrentPlayer, text,
+	    arena);
+    if (arena == NULL) {
+        free(data);
+    }
+    return status;
+}
+
+/* Read everything left in the given file descriptor into memory from the
+ * given arena, or the heap if it is NULL
+ * Return the data read (with its length in length), or NULL on an error
+ * */
+char* read_file(int fd, size_t* length, Arena* arena) {
+    size_t capacity = 4096;
+    char* data = (char*)arena_alloc(arena, capacity);
+
+    *length = 0;
+    while (data != NULL) {
+        ssize_t count;
+
+        if (*length == capacity) {
+            char* grown = (char*)arena_grow(arena, data, capacity,
+		    capacity * 2);
+
+            if (grown == NULL) {
+                break;
+            }
+            data = grown;
+            capacity *= 2;
+        }
+
+        count = read(fd, data + *length, capacity - *length);
+        if (count == 0) {
+            return data;
+        } else if (count > 0) {
+            *length += count;
+        } else if (errno != EINTR) {
+            break;
+        }
+    }
+
+    if (arena == NULL) {
+        free(data);
+    }
+    return NULL;
+}
+
+/* Load a text savefile a line at a time from the stream it is open on, so
+ * that no more than one row of its text is held at once
+ * Binary savefiles, and streams other than regular files (whose length
+ * cannot be checked before the board is allocated), are loaded whole by
+ * load_savefile instead, without keeping any text
+ * Return LOAD_OK, LOAD_FULL or LOAD_INVALID as for load_savefile
+ * */
+int stream_savefile(FILE* saveFile, Positions** pPositions,
+	char* pCurrentPlayer) {
+    char magic[BINARY_MAGIC_LENGTH];
+    SavefileStream stream;
+    struct stat info;
+    int status;
+
+    if (fstat(fileno(saveFile), &info) != 0 || !S_ISREG(info.st_mode) ||
+	    (fread(magic, 1, BINARY_MAGIC_LENGTH, saveFile) ==
+	    BINARY_MAGIC_LENGTH &&
+	    memcmp(magic, BINARY_MAGIC, BINARY_MAGIC_LENGTH) == 0)) {
+        return load_savefile(fileno(saveFile), pPositions, pCurrentPlayer,
+		NULL, NULL);
+    }
+
+    rewind(saveFile);
+    stream.file = saveFile;
+    stream.line = NULL;
+    stream.capacity = 0;
+    stream.ended = false;
+    status = stream_rows(&stream, info.st_size, pPositions, pCurrentPlayer);
+    free(stream.line);
+    return status;
+}
+
+/* Check the lines of a streamed text savefile of size bytes and build its
+ * board from them one row at a time, as parse_savefile does for a savefile
+ * held in memory
+ * Return LOAD_OK, LOAD_FULL or LOAD_INVALID as for load_savefile
+ * */
+int stream_rows(SavefileStream* stream, off_t size, Positions** pPositions,
+	char* pCurrentPlayer) {
+    bool blankCorner = false;
+    Positions* positions;
+    size_t length;
+    off_t remaining;
+    int rows, columns, r;
+
+    *pPositions = NULL;
+    if (!stream_line(stream, &length) ||
+	    !parse_dimensions(stream->line, length, &rows, &columns)) {
+        return LOAD_INVALID;
+    }
+
+    if (!stream_line(stream, &length) || length != 1 ||
+	    (stream->line[0] != 'O' && stream->line[0] != 'X')) {
+        return LOAD_INVALID;
+    }
+    *pCurrentPlayer = stream->line[0];
+
+    /* As for a savefile held in memory, a board with more positions than
+     * the rest of the file has room for is never allocated */
+    remaining = size - ftello(stream->file);
+    if (remaining < 0 || (uint64_t)rows * columns * 2 > (uint64_t)remaining) {
+        return LOAD_INVALID;
+    }
+
+    positions = allocate_positions(rows, columns, NULL);
+    for (r = 0; r < rows; r++) {
+        if (!stream_line(stream, &length) || length != (size_t)columns * 2 ||
+		!parse_row(positions, r, stream->line, &blankCorner)) {
+            break;
+        }
+    }
+
+    if (r < rows || stream_line(stream, &length) || !blankCorner) {
+        free_positions(positions);
+        return LOAD_INVALID;
+    }
+
+    *pPositions = positions;
+    return game_over(positions) ? LOAD_FULL : LOAD_OK;
+}
+
+/* Read the next non-empty line of a streamed savefile into stream->line,
+ * without its newline, treating a null character as the end of the
+ * savefile's contents as next_line does
+ * Return false if there are no lines left, or true otherwise
+ * */
+bool stream_line(SavefileStream* stream, size_t* length) {
+    ssize_t count;
+    char* nul;
+
+    if (stream->ended) {
+        return false;
+    }
+
+    do {
+        count = getline(&stream->line, &stream->capacity, stream->file);
+        if (count < 0) {
+            return false;
+        }
+    } while (count == 1 && stream->line[0] == '\n');
+
+    *length = count;
+    nul = memchr(stream->line, '\0', count);
+    if (nul != NULL) {
+        stream->ended = true;
+        *length = nul - stream->line;
+        return *length > 0;
+    }
+    if (stream->line[count - 1] == '\n') {
+        (*length)--;
+    }
+    return true;
+}
+
+/* Print the most memory this process has held at once (its peak resident
+ * set size) to stderr
+ * */
+void report_peak_memory(void) {
+    struct rusage usage;
+
+    fflush(stdout);
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+        fprintf(stderr, "Peak memory: %ld KB\n", usage.ru_maxrss);
+    }
+}
+
+/* Check the contents of a savefile and build its board in a single pass
+ * over its lines, where empty lines are skipped and a null character ends
+ * the contents
+ * The first line holds the number of rows and columns, the second the
+ * player to move, then each row of the board follows with a score digit
+ * and a stone ('.', 'O' or 'X') for each position
+ * Positions on the edge of the board other than corners are checked, and
+ * at least one character of a corner position must be blank
+ * Savefiles starting with BINARY_MAGIC are handed to parse_binary_savefile
+ * The positions come from the given arena, or the heap if it is NULL
+ * Return LOAD_OK, LOAD_FULL or LOAD_INVALID as for load_savefile
+ * */
+int parse_savefile(char* data, size_t length, Positions** pPositions,
+	char* pCurrentPlayer, BoardText* text, Arena* arena) {
+    char* end, *position = data, *line;
+    size_t lineLength, textLine;
+    bool blankCorner = false;
+    Positions* positions;
+    int rows, columns, r;
+
+    if (length >= BINARY_MAGIC_LENGTH &&
+	    memcmp(data, BINARY_MAGIC, BINARY_MAGIC_LENGTH) == 0) {
+        return parse_binary_savefile((unsigned char*)data, length,
+		pPositions, pCurrentPlayer, text, arena);
+    }
+
+    *pPositions = NULL;
+    end = memchr(data, '\0', length);
+    if (end == NULL) {
+        end = data + length;
+    }
+
+    if (!next_line(&position, end, &line, &lineLength) ||
+	    !parse_dimensions(line, lineLength, &rows, &columns)) {
+        return LOAD_INVALID;
+    }
+
+    if (!next_line(&position, end, &line, &lineLength) || lineLength != 1 ||
+	    (line[0] != 'O' && line[0] != 'X')) {
+        return LOAD_INVALID;
+    }
+    *pCurrentPlayer = line[0];
+
+    /* A board with more positions than the file has room for is invalid,
+     * and is never allocated */
+    if ((uint64_t)rows * columns * 2 > (uint64_t)(end - position)) {
+        return LOAD_INVALID;
+    }
+
+    positions = allocate_positions(rows, columns, arena);
+    textLine = (size_t)columns * 2 + 1;
+    if (text != NULL) {
+        text->length = textLine * rows;
+        text->text = (char*)malloc(text->length);
+        text->stale = false;
+    }
+
+    for (r = 0; r < rows; r++) {
+        if (!next_line(&position, end, &line, &lineLength) ||
+		lineLength != (size_t)columns * 2 ||
+		!parse_row(positions, r, line, &blankCorner)) {
+            break;
+        }
+
+        if (text != NULL) {
+            memcpy(text->text + textLine * r, line, lineLength);
+            text->text[textLine * r + lineLength] = '\n';
+        }
+    }
+
+    if (r < rows || next_line(&position, end, &line, &lineLength) ||
+	    !blankCorner) {
+        if (arena == NULL) {
+            free_positions(positions);
+        }
+        if (text != NULL) {
+            free(text->text);
+        }
+        return LOAD_INVALID;
+    }
+
+    *pPositions = positions;
+    return game_over(positions) ? LOAD_FULL : LOAD_OK;
+}
+
+/* Find the next non-empty line of a savefile, starting from position and
+ * moving position past it
+ * Return false if there are no lines left, or true otherwise
+ * */
+bool next_line(char** position, char* end, char** line, size_t* length) {
+    char* newline;
+
+    while (*position < end && **position == '\n') {
+        (*position)++;
+    }
+    if (*position == end) {
+        return false;
+    }
+
+    *line = *position;
+    newline = memchr(*position, '\n', end - *position);
+    *length = (newline == NULL ? end : newline) - *position;
+    *position = newline == NULL ? end : newline + 1;
+    return true;
+}
+
+/* Read the number of rows and columns from the first line of a savefile,
+ * two numbers which may have other text after them
+ * Return true if both numbers are read and are positive, false otherwise
+ * */
+bool parse_dimensions(char* line, size_t length, int* rows, int* columns) {
+    char* end = line + length;
+
+    return parse_int(&line, end, rows) && parse_int(&line, end, columns) &&
+	    *rows >= 1 && *columns >= 1;
+}
+
+/* Read a decimal number (after any white space, with an optional sign)
+ * from text, moving text past it
+ * Return false if there is no number or it does not fit in an int
+ * */
+bool parse_int(char** text, char* end, int* number) {
+    long value = 0;
+    bool negative = false, digits = false;
+
+    while (*text < end && isspace((unsigned char)**text)) {
+        (*text)++;
+    }
+    if (*text < end && (**text == '-' || **text == '+')) {
+        negative = **text == '-';
+        (*text)++;
+    }
+
+    while (*text < end && isdigit((unsigned char)**text)) {
+        value = value * 10 + (**text - '0');
+        if (value > INT_MAX) {
+            return false;
+        }
+        digits = true;
+        (*text)++;
+    }
+
+    *number = negative ? (int)-value : (int)value;
+    return digits;
+}
+
+/* Check one row of a savefile and set up its positions, filling in each
+ * word of the row's planes and the empty position indexes directly rather
+ * than setting one position at a time
+ * The first and last rows have their corner positions skipped, and note in
+ * blankCorner if any character of a corner is blank
+ * Return true if the row is valid and false otherwise
+ * */
+bool parse_row(Positions* positions, int row, char* line,
+	bool* blankCorner) {
+    int rows = positions->rows, columns = positions->columns;
+    int first = 0, last = columns - 1, c;
+    unsigned char* scores = positions->scores + (size_t)row * columns;
+    uint64_t* oRow = plane_row(positions, positions->oPlane, row);
+    uint64_t* xRow = plane_row(positions, positions->xPlane, row);
+    uint64_t* emptyRow = plane_row(positions, positions->emptyPlane, row);
+    uint64_t columnBit = (uint64_t)1 << (row % PLANE_BITS);
+    uint64_t* columnWord = positions->emptyColumnPlane + row / PLANE_BITS;
+
+    if (row == 0 || row == rows - 1) {
+        if (line[0] == ' ' || line[1] == ' ' || line[columns * 2 - 2] == ' ' ||
+		line[columns * 2 - 1] == ' ') {
+            *blankCorner = true;
+        }
+        first = 1;
+        last = columns - 2;
+    }
+
+    for (c = 0; c < columns; c++) {
+        char score = line[c * 2], stone = line[c * 2 + 1];
+        uint64_t bit = (uint64_t)1 << (c % PLANE_BITS);
+        int word = c / PLANE_BITS;
+
+        if (c >= first && c <= last && (!isdigit((unsigned char)score) ||
+		(stone != '.' && stone != 'X' && stone != 'O'))) {
+            return false;
+        }
+
+        if (isdigit((unsigned char)score)) {
+            scores[c] = score - '0';
+        }
+
+        if (stone == 'O') {
+            oRow[word] |= bit;
+        } else if (stone == 'X') {
+            xRow[word] |= bit;
+        } else if (stone == '.') {
+            emptyRow[word] |= bit;
+            columnWord[(size_t)c * positions->columnWords] |= columnBit;
+            positions->rowEmpties[row]++;
+            positions->columnEmpties[c]++;
+            if (first == 0 && c > 0 && c < columns - 1) {
+                positions->interiorEmpties++;
+            }
+
+            /* Rows are read in order, so the first empty row after row 0
+             * is the first one seen and the last is the latest one */
+            if (row > 0 && positions->columnFirstEmpty[c] == rows) {
+                positions->columnFirstEmpty[c] = row;
+            }
+            if (row < rows - 1) {
+                positions->columnLastEmpty[c] = row;
+            }
+        }
+    }
+
+    c = first_set_bit(emptyRow, 1, columns - 1);
+    positions->rowFirstEmpty[row] = c == -1 ? columns : c;
+    positions->rowLastEmpty[row] = last_set_bit(emptyRow, 0, columns - 2);
+    return true;
+}
+
+/* Print the error for a savefile which could not be loaded and exit with
+ * its status
+ * */
+void exit_load_error(int status) {
+    if (status == LOAD_FULL) {
+        fprintf(stderr, "Full board in load\n");
+    } else {
+        fprintf(stderr, "Invalid file contents\n");
+    }
+    exit(status);
+}
+
+/* Check the contents of a binary savefile and build its board straight
+ * from its planes, without going through the text of the board
+ * Return LOAD_OK, LOAD_FULL or LOAD_INVALID as for load_savefile
+ * */
+int parse_binary_savefile(unsigned char* data, size_t length,
+	Positions** pPositions, char* pCurrentPlayer, BoardText* text,
+	Arena* arena) {
+    unsigned char* stones = data + BINARY_HEADER, *scores;
+    uint64_t rows, columns, size;
+    bool blankCorner = false;
+    Positions* positions;
+    int r;
+
+    *pPositions = NULL;
+    if (length < BINARY_HEADER || data[BINARY_MAGIC_LENGTH] != BINARY_VERSION
+	    || (data[7] != 'O' && data[7] != 'X')) {
+        return LOAD_INVALID;
+    }
+    *pCurrentPlayer = data[7];
+    rows = read_little_endian(data + 8, 4);
+    columns = read_little_endian(data + 12, 4);
+
+    /* The file must hold exactly the planes of a board of its size */
+    size = rows * columns;
+    if (rows < 1 || columns < 1 || rows > INT_MAX || columns > INT_MAX ||
+	    length - BINARY_HEADER != (size + 3) / 4 + (size + 1) / 2 ||
+	    binary_checksum(stones, length - BINARY_HEADER) !=
+	    read_little_endian(data + 16, 8)) {
+        return LOAD_INVALID;
+    }
+    scores = stones + (size + 3) / 4;
+
+    positions = allocate_positions(rows, columns, arena);
+    for (r = 0; r < (int)rows; r++) {
+        if (!decode_row(positions, r, stones, scores, size, &blankCorner)) {
+            break;
+        }
+    }
+
+    if (r < (int)rows || !blankCorner) {
+        if (arena == NULL) {
+            free_positions(positions);
+        }
+        return LOAD_INVALID;
+    }
+
+    /* The text of the board is only rendered if it is needed */
+    if (text != NULL) {
+        text->length = ((size_t)columns * 2 + 1) * rows;
+        text->text = (char*)malloc(text->length);
+        text->stale = true;
+    }
+
+    *pPositions = positions;
+    return game_over(positions) ? LOAD_FULL : LOAD_OK;
+}
+
+/* Check one row of a binary savefile and set up its positions, as
+ * parse_row does for a row of text
+ * The row is unpacked 32 stones and 16 scores at a time, building each
+ * word of the row's planes before storing it
+ * Every position other than a corner must have a stone, every score must
+ * be from 0 to 9, and blankCorner notes if any corner is blank
+ * Return true if the row is valid and false otherwise
+ * */
+bool decode_row(Positions* positions, int row, unsigned char* stones,
+	unsigned char* scores, uint64_t size, bool* blankCorner) {
+    int rows = positions->rows, columns = positions->columns, word, part;
+    uint64_t cell = (uint64_t)row * columns, badScores = 0;
+    bool edgeRow = row == 0 || row == rows - 1;
+    uint64_t* oRow = plane_row(positions, positions->oPlane, row);
+    uint64_t* xRow = plane_row(positions, positions->xPlane, row);
+    uint64_t* emptyRow = plane_row(positions, positions->emptyPlane, row);
+    uint64_t columnBit = (uint64_t)1 << (row % PLANE_BITS);
+    uint64_t* columnWord = positions->emptyColumnPlane + row / PLANE_BITS;
+
+    for (word = 0; word < positions->rowWords; word++) {
+        int first = word * PLANE_BITS, c;
+        int count = columns - first < PLANE_BITS ? columns - first :
+		PLANE_BITS;
+        uint64_t o = 0, x = 0, empty = 0, blank = 0;
+        unsigned char* rowScores = positions->scores + cell;
+
+        /* The low bit of a stone's code is set for X and empty stones
+         * and the high bit for O and X stones */
+        for (part = 0; part < count; part += 32) {
+            uint64_t bits = read_bits(stones, (size + 3) / 4,
+		    (cell + part) * 2);
+            uint64_t low = pack_even_bits(bits);
+            uint64_t high = pack_even_bits(bits >> 1);
+            uint64_t mask = low_mask(count - part < 32 ? count - part :
+		    32);
+
+            o |= (high & ~low & mask) << part;
+            x |= (high & low & mask) << part;
+            empty |= (~high & low & mask) << part;
+            blank |= (~high & ~low & mask) << part;
+        }
+
+        for (part = 0; part < count; part += 16) {
+            uint64_t bits = read_bits(scores, (size + 1) / 2,
+		    (cell + part) * 4);
+            int n = count - part < 16 ? count - part : 16;
+            uint64_t lowScores = spread_nibbles(bits & 0xffffffff);
+            uint64_t highScores = spread_nibbles(bits >> 32);
+            unsigned char bytes[16];
+
+            /* Adding 0x76 to a score sets its top bit if it is over 9 */
+            badScores |= ((lowScores + 0x7676767676767676ULL) &
+		    low_mask(n * 8 < 64 ? n * 8 : 64)) |
+		    ((highScores + 0x7676767676767676ULL) &
+		    low_mask(n * 8 > 64 ? n * 8 - 64 : 0));
+            write_little_endian(bytes, lowScores, 8);
+            write_little_endian(bytes + 8, highScores, 8);
+            memcpy(rowScores + part, bytes, n);
+        }
+
+        if (blank & column_mask(word, edgeRow, columns - 1 - edgeRow)) {
+            return false;
+        }
+        if (edgeRow && blank) {
+            *blankCorner = true;
+        }
+        oRow[word] = o;
+        xRow[word] = x;
+        emptyRow[word] = empty;
+        positions->rowEmpties[row] += __builtin_popcountll(empty);
+        if (!edgeRow) {
+            positions->interiorEmpties += __builtin_popcountll(empty &
+		    column_mask(word, 1, columns - 2));
+        }
+
+        while (empty) {
+            c = first + __builtin_ctzll(empty);
+            empty &= empty - 1;
+            columnWord[(size_t)c * positions->columnWords] |= columnBit;
+            positions->columnEmpties[c]++;
+
+            /* Rows are decoded in order, as in parse_row */
+            if (row > 0 && positions->columnFirstEmpty[c] == rows) {
+                positions->columnFirstEmpty[c] = row;
+            }
+            if (row < rows - 1) {
+                positions->columnLastEmpty[c] = row;
+            }
+        }
+        cell += count;
+    }
+    if (badScores & 0x8080808080808080ULL) {
+        return false;
+    }
+
+    part = first_set_bit(emptyRow, 1, columns - 1);
+    positions->rowFirstEmpty[row] = part == -1 ? columns : part;
+    positions->rowLastEmpty[row] = last_set_bit(emptyRow, 0, columns - 2);
+    return true;
+}
+
+/* Pack one row of the board into the planes of a binary savefile, the
+ * reverse of decode_row
+ * */
+void encode_row(Positions* positions, int row, unsigned char* stones,
+	unsigned char* scores, uint64_t size) {
+    int columns = positions->columns, word, part;
+    uint64_t cell = (uint64_t)row * columns;
+    uint64_t* oRow = plane_row(positions, positions->oPlane, row);
+    uint64_t* xRow = plane_row(positions, positions->xPlane, row);
+    uint64_t* emptyRow = plane_row(positions, positions->emptyPlane, row);
+
+    for (word = 0; word < positions->rowWords; word++) {
+        int first = word * PLANE_BITS;
+        int count = columns - first < PLANE_BITS ? columns - first :
+		PLANE_BITS;
+        uint64_t low = xRow[word] | emptyRow[word];
+        uint64_t high = oRow[word] | xRow[word];
+        unsigned char* rowScores = positions->scores + cell;
+
+        for (part = 0; part < count; part += 32) {
+            uint64_t mask = low_mask(count - part < 32 ? count - part :
+		    32);
+
+            or_bits(stones, (size + 3) / 4, (cell + part) * 2,
+		    spread_bits((low >> part) & mask) |
+		    spread_bits((high >> part) & mask) << 1);
+        }
+
+        for (part = 0; part < count; part += 16) {
+            int n = count - part < 16 ? count - part : 16;
+            unsigned char bytes[16] = {0};
+
+            memcpy(bytes, rowScores + part, n);
+            or_bits(scores, (size + 1) / 2, (cell + part) * 4,
+		    pack_nibbles(read_little_endian(bytes, 8)) |
+		    pack_nibbles(read_little_endian(bytes + 8, 8)) << 32);
+        }
+        cell += count;
+    }
+}
+
+/* Read the 64 bits of data (length bytes long) starting at the given bit,
+ * where bits are numbered from the low bit of each byte and bits past the
+ * end of data read as 0
+ * */
+uint64_t read_bits(unsigned char* data, size_t length, uint64_t bit) {
+    unsigned char bytes[9] = {0};
+    size_t byte = bit / 8;
+    int shift = bit % 8;
+    uint64_t value;
+
+    memcpy(bytes, data + byte, length - byte < 9 ? length - byte : 9);
+    value = read_little_endian(bytes, 8) >> shift;
+    if (shift > 0) {
+        value |= (uint64_t)bytes[8] << (64 - shift);
+    }
+
+    return value;
+}
+
+/* Set the bits of value in the 64 bits of data (length bytes long)
+ * starting at the given bit, dropping any past the end of data
+ * */
+void or_bits(unsigned char* data, size_t length, uint64_t bit,
+	uint64_t value) {
+    unsigned char bytes[9];
+    size_t byte = bit / 8, count = length - byte < 9 ? length - byte : 9, i;
+    int shift = bit % 8;
+
+    write_little_endian(bytes, value << shift, 8);
+    bytes[8] = shift > 0 ? value >> (64 - shift) : 0;
+    for (i = 0; i < count; i++) {
+        data[byte + i] |= bytes[i];
+    }
+}
+
+/* Gather the even bits of a word into its low 32 bits
+ * */
+uint64_t pack_even_bits(uint64_t bits) {
+    bits &= 0x5555555555555555ULL;
+    bits = (bits | bits >> 1) & 0x3333333333333333ULL;
+    bits = (bits | bits >> 2) & 0x0f0f0f0f0f0f0f0fULL;
+    bits = (bits | bits >> 4) & 0x00ff00ff00ff00ffULL;
+    bits = (bits | bits >> 8) & 0x0000ffff0000ffffULL;
+    return (bits | bits >> 16) & 0x00000000ffffffffULL;
+}
+
+/* Spread the low 32 bits of a word out to its even bits, the reverse of
+ * pack_even_bits
+ * */
+uint64_t spread_bits(uint64_t bits) {
+    bits &= 0x00000000ffffffffULL;
+    bits = (bits | bits << 16) & 0x0000ffff0000ffffULL;
+    bits = (bits | bits << 8) & 0x00ff00ff00ff00ffULL;
+    bits = (bits | bits << 4) & 0x0f0f0f0f0f0f0f0fULL;
+    bits = (bits | bits << 2) & 0x3333333333333333ULL;
+    return (bits | bits << 1) & 0x5555555555555555ULL;
+}
+
+/* Gather the low nibble of each byte of a word into its low 32 bits
+ * */
+uint64_t pack_nibbles(uint64_t bytes) {
+    bytes &= 0x0f0f0f0f0f0f0f0fULL;
+    bytes = (bytes | bytes >> 4) & 0x00ff00ff00ff00ffULL;
+    bytes = (bytes | bytes >> 8) & 0x0000ffff0000ffffULL;
+    return (bytes | bytes >> 16) & 0x00000000ffffffffULL;
+}
+
+/* Spread the 8 nibbles in the low 32 bits of a word out to one byte each,
+ * the reverse of pack_nibbles
+ * */
+uint64_t spread_nibbles(uint64_t nibbles) {
+    nibbles &= 0x00000000ffffffffULL;
+    nibbles = (nibbles | nibbles << 16) & 0x0000ffff0000ffffULL;
+    nibbles = (nibbles | nibbles << 8) & 0x00ff00ff00ff00ffULL;
+    return (nibbles | nibbles << 4) & 0x0f0f0f0f0f0f0f0fULL;
+}
+
+/* Return a word with its lowest count bits set (all of them from 64 on)
+ * */
+uint64_t low_mask(int count) {
+    return count >= 64 ? ~(uint64_t)0 : ((uint64_t)1 << count) - 1;
+}
+
+/* Checksum the planes of a binary savefile, mixing in 8 bytes at a time
+ * so large boards are checked at close to memory speed
+ * */
+uint64_t binary_checksum(unsigned char* data, size_t length) {
+    uint64_t sum = 0xcbf29ce484222325ULL;
+    size_t i;
+
+    for (i = 0; i + 8 <= length; i += 8) {
+        uint64_t word;
+
+        memcpy(&word, data + i, 8);
+        sum = (sum ^ word) * 0x100000001b3ULL;
+    }
+    for (; i < length; i++) {
+        sum = (sum ^ data[i]) * 0x100000001b3ULL;
+    }
+
+    return sum ^ (sum >> 29);
+}
+
+/* Read a number stored in the given number of bytes, low byte first
+ * */
+uint64_t read_little_endian(unsigned char* data, int bytes) {
+    uint64_t value = 0;
+    int i;
+
+    for (i = bytes - 1; i >= 0; i--) {
+        value = (value << 8) | data[i];
+    }
+
+    return value;
+}
+
+/* Store a number in the given number of bytes, low byte first
+ * */
+void write_little_endian(unsigned char* data, uint64_t value, int bytes) {
+    int i;
+
+    for (i = 0; i < bytes; i++) {
+        data[i] = value & 0xff;
+        value >>= 8;
+    }
+}
+
+/* Convert a savefile between the text and binary formats, given the
+ * arguments after "convert": format infile outfile, where format is the
+ * format to write ("text" or "binary") and infile may be in either format
+ * Boards which are already full are converted, as they still load
+ * Return the exit status of the program: 0 on success, the usual statuses
+ * for bad arguments or savefiles, or 7 if the output could not be written
+ * */
+int convert_main(int argc, char** argv) {
+    Positions* positions;
+    char currentPlayer;
+    BoardText text;
+    FILE* inputFile;
+    bool saved;
+    int status;
+
+    if (argc != 3 || (strcmp(argv[0], "text") != 0 &&
+	    strcmp(argv[0], "binary") != 0)) {
+        fprintf(stderr,
+		"Usage: push2310 convert text|binary infile outfile\n");
+        exit(1);
+    }
+
+    inputFile = fopen(argv[1], "r");
+    if (inputFile == NULL) {
+        fprintf(stderr, "No file to load from\n");
+        exit(3);
+    }
+    status = load_savefile(fileno(inputFile), &positions, &currentPlayer,
+	    &text, NULL);
+    fclose(inputFile);
+    if (status == LOAD_INVALID) {
+        exit_load_error(status);
+    }
+
+    if (argv[0][0] == 't') {
+        saved = save_game(&text, positions, argv[2], &currentPlayer);
+    } else {
+        saved = save_binary(positions, argv[2], currentPlayer);
+        if (!saved) {
+            fprintf(stderr, "Save failed\n");
+        }
+    }
+
+    free(text.text);
+    free_positions(positions);
+    return saved ? 0 : 7;
+}
+
+/* Set up the engine for the search players with the given options
+ * */
+void init_engine(Engine* engine, Options* options) {
+    int i;
+
+    engine->options = options;
+    memset(&engine->table, 0, sizeof(TranspositionTable));
+    engine->seed = 0;
+    engine->reportMoves = true;
+    engine->solveFailed = 0;
+    engine->ponderMove = -1;
+    engine->playouts = 0;
+    engine->playoutTime = 0;
+    engine->arenas = (Arena*)malloc(sizeof(Arena) * (options->threads + 1));
+    for (i = 0; i <= options->threads; i++) {
+        init_arena(&engine->arenas[i]);
+    }
+}
+
+/* Free the transposition table and arenas of an engine
+ * */
+void free_engine(Engine* engine) {
+    int i;
+
+    free_table(&engine->table);
+    for (i = 0; i <= engine->options->threads; i++) {
+        free_arena(&engine->arenas[i]);
+    }
+    free(engine->arenas);
+}
+
+/* Play a batch of games between two automated players without displaying
+ * them, given the arguments after "batch": typeO typeX games path
+ * The path is a savefile or a directory of savefiles, and the games are
+ * shared out between -j worker threads, each searching on one thread
+ * Print the combined results of the games
+ * Return the exit status of the program
+ * */
+int batch_main(int argc, char** argv, Options* options) {
+    Batch batch;
+    BatchWorker* workers;
+    double start;
+    int i;
+
+    if (argc != 4 || !parse_number(argv[2], &batch.games) ||
+	    batch.games < 1) {
+        fprintf(stderr, "Usage: push2310 batch typeO typeX games path\n");
+        exit(1);
+    }
+
+    batch.oType = argv[0][0];
+    batch.xType = argv[1][0];
+    if (!valid_player_type(batch.oType) || batch.oType == 'H' ||
+	    !valid_player_type(batch.xType) || batch.xType == 'H') {
+        fprintf(stderr, "Invalid player type\n");
+        exit(2);
+    }
+
+    load_batch(&batch, argv[3]);
+    batch.nextGame = 0;
+    batch.options = options;
+
+    start = now_ms();
+    workers = (BatchWorker*)calloc(options->threads, sizeof(BatchWorker));
+    for (i = 0; i < options->threads; i++) {
+        workers[i].batch = &batch;
+    }
+    for (i = 1; i < options->threads; i++) {
+        workers[i].started = pthread_create(&workers[i].thread, NULL,
+		run_batch_worker, &workers[i]) == 0;
+    }
+
+    run_batch_worker(&workers[0]);
+    for (i = 1; i < options->threads; i++) {
+        if (workers[i].started) {
+            pthread_join(workers[i].thread, NULL);
+        }
+    }
+
+    report_batch(workers, options->threads, batch.games, now_ms() - start);
+
+    for (i = 0; i < batch.fileCount; i++) {
+        free_positions(batch.positions[i]);
+    }
+    free(batch.positions);
+    free(batch.players);
+    free(workers);
+    return 0;
+}
+
+/* Load the savefile at the given path into the batch, or every file in it
+ * (in name order) if it is a directory
+ * Exit if there is nothing to load or a savefile is invalid
+ * */
+void load_batch(Batch* batch, char* path) {
+    char** names = NULL;
+    int count = 0, i;
+
+    batch->positions = NULL;
+    batch->players = NULL;
+    batch->fileCount = 0;
+
+    list_savefiles(path, &names, &count);
+    for (i = 0; i < count; i++) {
+        add_batch_file(batch, names[i]);
+        free(names[i]);
+    }
+    free(names);
+
+    if (batch->fileCount == 0) {
+        fprintf(stderr, "No file to load from\n");
+        exit(3);
+    }
+}
+
+/* Add the savefiles at the given path to the list of names (which has
+ * count names): every regular file in it, in name order, if it is a
+ * directory, or otherwise the path itself
+ * The names added are allocated and must be freed
+ * */
+void list_savefiles(char* path, char*** names, int* count) {
+    struct stat info;
+
+    if (stat(path, &info) == 0 && S_ISDIR(info.st_mode)) {
+        DIR* directory = opendir(path);
+        struct dirent* entry;
+        int first = *count;
+
+        while (directory != NULL && (entry = readdir(directory)) != NULL) {
+            char* name = (char*)malloc(strlen(path) + strlen(entry->d_name) +
+		    2);
+
+            sprintf(name, "%s/%s", path, entry->d_name);
+            if (stat(name, &info) == 0 && S_ISREG(info.st_mode)) {
+                *names = (char**)realloc(*names, sizeof(char*) *
+			(*count + 1));
+                (*names)[(*count)++] = name;
+            } else {
+                free(name);
+            }
+        }
+        if (directory != NULL) {
+            closedir(directory);
+        }
+
+        qsort(*names + first, *count - first, sizeof(char*), compare_names);
+    } else {
+        *names = (char**)realloc(*names, sizeof(char*) * (*count + 1));
+        (*names)[(*count)++] = strdup(path);
+    }
+}
+
+/* Load one savefile into the batch
+ * Exit if the file cannot be opened or its contents are invalid
+ * */
+void add_batch_file(Batch* batch, char* fileName) {
+    FILE* saveFile = fopen(fileName, "r");
+    Positions* positions;
+    char currentPlayer;
+    int status;
+
+    if (saveFile == NULL) {
+        fprintf(stderr, "No file to load from\n");
+        exit(3);
+    }
+
+    status = load_savefile(fileno(saveFile), &positions, &currentPlayer,
+	    NULL, NULL);
+    fclose(saveFile);
+    if (status != LOAD_OK) {
+        exit_load_error(status);
+    }
+
+    batch->positions = (Positions**)realloc(batch->positions,
+	    sizeof(Positions*) * (batch->fileCount + 1));
+    batch->players = (char*)realloc(batch->players, batch->fileCount + 1);
+    batch->positions[batch->fileCount] = positions;
+    batch->players[batch->fileCount] = currentPlayer;
+    batch->fileCount++;
+}
+
+/* Compare two file names for sorting
+ * */
+int compare_names(const void* first, const void* second) {
+    return strcmp(*(char* const*)first, *(char* const*)second);
+}
+
+/* Play games from a batch until there are none left, totalling their
+ * results in the worker
+ * Each game is played on a copy of its savefile's board in an arena which
+ * is reset for the next game
+ * The engine is cleared before each game, as its table's values depend on
+ * the board's scores and so that a game plays the same whichever games the
+ * worker played before it
+ * */
+void* run_batch_worker(void* batchWorker) {
+    BatchWorker* worker = (BatchWorker*)batchWorker;
+    Batch* batch = worker->batch;
+    Options options = *batch->options;
+    Arena gameArena;
+    Engine engine;
+    MoveRecord record;
+    int game;
+
+    options.threads = 1;
+    init_engine(&engine, &options);
+    engine.reportMoves = false;
+    init_arena(&gameArena);
+
+    while ((game = __atomic_fetch_add(&batch->nextGame, 1,
+	    __ATOMIC_RELAXED)) < batch->games) {
+        GameState state;
+        char player = batch->players[game % batch->fileCount];
+        int columns, margin;
+
+        initialise_game(&state, copy_positions(
+		batch->positions[game % batch->fileCount], &gameArena),
+		&gameArena);
+        columns = state.positions->columns;
+        engine.seed = game;
+        engine.solveFailed = 0;
+        clear_table(&engine.table);
+
+        while (!game_over(state.positions)) {
+            int index = automated_move(&state, player == 'O' ? batch->oType :
+		    batch->xType, player, &engine);
+
+            apply_move(&state, index / columns, index % columns, player,
+		    &record);
+            player = other_player(player);
+        }
+
+        margin = state.oScore - state.xScore;
+        worker->margin += margin;
+        if (margin > 0) {
+            worker->oWins++;
+            worker->winningMargin += margin;
+        } else if (margin < 0) {
+            worker->xWins++;
+            worker->winningMargin -= margin;
+        } else {
+            worker->ties++;
+        }
+
+        reset_arena(&gameArena);
+    }
+
+    worker->playouts = engine.playouts;
+    worker->playoutTime = engine.playoutTime;
+    free_arena(&gameArena);
+    free_engine(&engine);
+    return NULL;
+}
+
+/* Print the combined results of a batch of games which took the given time
+ * to play (ms)
+ * */
+void report_batch(BatchWorker* workers, int count, int games,
+	double elapsed) {
+    long oWins = 0, xWins = 0, ties = 0, playouts = 0;
+    long long margin = 0, winningMargin = 0;
+    double playoutTime = 0;
+    int i;
+
+    for (i = 0; i < count; i++) {
+        oWins += workers[i].oWins;
+        xWins += workers[i].xWins;
+        ties += workers[i].ties;
+        margin += workers[i].margin;
+        winningMargin += workers[i].winningMargin;
+        playouts += workers[i].playouts;
+        playoutTime += workers[i].playoutTime;
+    }
+
+    printf("Games: %d\n", games);
+    printf("O wins: %ld (%.1f%%)\n", oWins, oWins * 100.0 / games);
+    printf("X wins: %ld (%.1f%%)\n", xWins, xWins * 100.0 / games);
+    printf("Ties: %ld (%.1f%%)\n", ties, ties * 100.0 / games);
+    printf("Average margin (O - X): %.2f\n", (double)margin / games);
+    printf("Average winning margin: %.2f\n", oWins + xWins > 0 ?
+	    (double)winningMargin / (oWins + xWins) : 0.0);
+    printf("Games per second: %.1f\n", elapsed > 0 ? games * 1000.0 /
+	    elapsed : 0.0);
+    if (playouts > 0) {
+        printf("Playouts per second per thread: %.0f\n", playoutTime > 0 ?
+		playouts * 1000.0 / playoutTime : 0.0);
+    }
+}
+
+/* Check many savefiles on -j threads without playing them, given the
+ * arguments after "validate": a list of paths, each a savefile or a
+ * directory of savefiles, where "-" reads more paths from standard input,
+ * one per line
+ * Print one line for each savefile, in the order given: the exit status
+ * push2310 would give for it, the kind of error, the player to move, the
+ * board's rows and columns, each player's score and the number of legal
+ * moves, then the path (with "-" for anything not known as the board did
+ * not load)
+ * Return the exit status of the program
+ * */
+int validate_main(int argc, char** argv, Options* options) {
+    Validation validation;
+    pthread_t* threads;
+    bool* started;
+    char** names = NULL;
+    int count = 0, i;
+
+    if (argc < 1) {
+        fprintf(stderr, "Usage: push2310 validate path ...\n");
+        exit(1);
+    }
+
+    for (i = 0; i < argc; i++) {
+        if (strcmp(argv[i], "-") == 0) {
+            char* line = NULL;
+            size_t capacity = 0;
+            ssize_t length;
+
+            while ((length = getline(&line, &capacity, stdin)) > 0) {
+                if (line[length - 1] == '\n') {
+                    line[--length] = '\0';
+                }
+                if (length > 0) {
+                    list_savefiles(line, &names, &count);
+                }
+            }
+            free(line);
+        } else {
+            list_savefiles(argv[i], &names, &count);
+        }
+    }
+
+    validation.checks = (FileCheck*)calloc(count, sizeof(FileCheck));
+    validation.count = count;
+    validation.next = 0;
+    for (i = 0; i < count; i++) {
+        validation.checks[i].path = names[i];
+    }
+
+    threads = (pthread_t*)malloc(sizeof(pthread_t) * options->threads);
+    started = (bool*)calloc(options->threads, sizeof(bool));
+    for (i = 1; i < options->threads; i++) {
+        started[i] = pthread_create(&threads[i], NULL, run_validation,
+		&validation) == 0;
+    }
+    run_validation(&validation);
+    for (i = 1; i < options->threads; i++) {
+        if (started[i]) {
+            pthread_join(threads[i], NULL);
+        }
+    }
+
+    for (i = 0; i < count; i++) {
+        report_check(&validation.checks[i]);
+        free(names[i]);
+    }
+
+    free(names);
+    free(validation.checks);
+    free(threads);
+    free(started);
+    return 0;
+}
+
+/* Check savefiles from a validation until there are none left
+ * */
+void* run_validation(void* validation) {
+    Validation* list = (Validation*)validation;
+    int i;
+
+    while ((i = __atomic_fetch_add(&list->next, 1, __ATOMIC_RELAXED)) <
+	    list->count) {
+        check_file(&list->checks[i]);
+    }
+
+    return NULL;
+}
+
+/* Load the savefile at a check's path, and fill in the check with what
+ * was found
+ * */
+void check_file(FileCheck* check) {
+    int fd = open(check->path, O_RDONLY);
+    Positions* positions;
+    GameState game;
+
+    if (fd == -1) {
+        check->status = 3;
+        return;
+    }
+    check->status = load_savefile(fd, &positions, &check->player, NULL,
+	    NULL);
+    close(fd);
+    if (check->status == LOAD_INVALID) {
+        return;
+    }
+
+    initialise_game(&game, positions, NULL);
+    check->rows = positions->rows;
+    check->columns = positions->columns;
+    check->oScore = game.oScore;
+    check->xScore = game.xScore;
+    check->moves = 0;
+    if (check->status == LOAD_OK) {
+        generate_moves(&game, &game.moves);
+        check->moves = game.moves.count;
+    }
+    free_game(&game);
+}
+
+/* Print the result line for a checked savefile
+ * */
+void report_check(FileCheck* check) {
+    if (check->status == 3) {
+        printf("3 unreadable - - - - - - %s\n", check->path);
+    } else if (check->status == LOAD_INVALID) {
+        printf("%d invalid - - - - - - %s\n", LOAD_INVALID, check->path);
+    } else {
+        printf("%d %s %c %d %d %d %d %d %s\n", check->status,
+		check->status == LOAD_FULL ? "full" : "ok", check->player,
+		check->rows, check->columns, check->oScore, check->xScore,
+		check->moves, check->path);
+    }
+}
+
+/* Count every position reachable in exactly depth moves from a savefile,
+ * given the arguments after "perft": depth fname [split]
+ * The root moves are shared out between -j threads; with "split" the
+ * count below each root move is printed (as row and column) before the
+ * total, the time taken and the nodes counted per second
+ * Return the exit status of the program
+ * */
+int perft_main(int argc, char** argv, Options* options) {
+    Positions* positions;
+    PerftWorker* workers;
+    GameState game;
+    Perft count;
+    FILE* saveFile;
+    long long nodes = 0;
+    double start, elapsed;
+    int status, i;
+
+    if ((argc != 2 && argc != 3) || !parse_number(argv[0], &count.depth) ||
+	    count.depth < 0 || (argc == 3 && strcmp(argv[2], "split") != 0)) {
+        fprintf(stderr, "Usage: push2310 perft depth fname [split]\n");
+        exit(1);
+    }
+
+    saveFile = fopen(argv[1], "r");
+    if (saveFile == NULL) {
+        fprintf(stderr, "No file to load from\n");
+        exit(3);
+    }
+    status = load_savefile(fileno(saveFile), &positions, &count.player,
+	    NULL, NULL);
+    fclose(saveFile);
+    if (status == LOAD_INVALID) {
+        exit_load_error(status);
+    }
+
+    initialise_game(&game, positions, NULL);
+    count.game = &game;
+    init_move_list(&count.rootMoves, positions, NULL);
+    if (!game_over(positions)) {
+        generate_moves(&game, &count.rootMoves);
+    }
+    count.counts = (long long*)calloc(count.rootMoves.count + 1,
+	    sizeof(long long));
+    count.nextMove = 0;
+
+    start = now_ms();
+    if (count.depth == 0) {
+        nodes = 1;
+    } else {
+        workers = (PerftWorker*)calloc(options->threads,
+		sizeof(PerftWorker));
+        for (i = 0; i < options->threads; i++) {
+            workers[i].perft = &count;
+        }
+        for (i = 1; i < options->threads; i++) {
+            workers[i].started = pthread_create(&workers[i].thread, NULL,
+		    run_perft_worker, &workers[i]) == 0;
+        }
+        run_perft_worker(&workers[0]);
+        for (i = 1; i < options->threads; i++) {
+            if (workers[i].started) {
+                pthread_join(workers[i].thread, NULL);
+            }
+        }
+        free(workers);
+
+        for (i = 0; i < count.rootMoves.count; i++) {
+            nodes += count.counts[i];
+        }
+    }
+    elapsed = now_ms() - start;
+
+    if (argc == 3 && count.depth > 0) {
+        for (i = 0; i < count.rootMoves.count; i++) {
+            printf("%d %d: %lld\n", count.rootMoves.moves[i] /
+		    positions->columns, count.rootMoves.moves[i] %
+		    positions->columns, count.counts[i]);
+        }
+    }
+    printf("Nodes: %lld\n", nodes);
+    printf("Time: %.0f ms\n", elapsed);
+    printf("Nodes per second: %.0f\n", elapsed > 0 ? nodes * 1000.0 /
+	    elapsed : 0.0);
+
+    free(count.counts);
+    free_move_list(&count.rootMoves);
+    free_game(&game);
+    return 0;
+}
+
+/* Count positions below root moves of a perft count until there are none
+ * left, on a copy of its game
+ * */
+void* run_perft_worker(void* perftWorker) {
+    Perft* count = ((PerftWorker*)perftWorker)->perft;
+    MoveList* plyMoves = (MoveList*)malloc(sizeof(MoveList) * count->depth);
+    int columns = count->game->positions->columns, i;
+    MoveRecord record;
+    GameState game;
+
+    copy_game(&game, count->game, NULL);
+    for (i = 0; i < count->depth; i++) {
+        init_move_list(&plyMoves[i], game.positions, NULL);
+    }
+
+    while ((i = __atomic_fetch_add(&count->nextMove, 1, __ATOMIC_RELAXED)) <
+	    count->rootMoves.count) {
+        int move = count->rootMoves.moves[i];
+
+        apply_move(&game, move / columns, move % columns, count->player,
+		&record);
+        count->counts[i] = perft(&game, plyMoves, count->depth - 1,
+		other_player(count->player));
+        undo_move(&game, &record);
+    }
+
+    for (i = 0; i < count->depth; i++) {
+        free_move_list(&plyMoves[i]);
+    }
+    free(plyMoves);
+    free_game(&game);
+    return NULL;
+}
+
+/* Count the positions reachable in exactly depth moves from the game with
+ * the given player to move, using a move list for each ply from plyMoves
+ * Positions at the last ply are counted from the move list rather than
+ * played; no moves are made once the game is over
+ * */
+long long perft(GameState* game, MoveList* plyMoves, int depth, char player) {
+    int columns = game->positions->columns, i;
+    MoveList* moves = plyMoves;
+    long long nodes = 0;
+    MoveRecord record;
+
+    if (depth == 0) {
+        return 1;
+    }
+    if (game_over(game->positions)) {
+        return 0;
+    }
+
+    generate_moves(game, moves);
+    if (depth == 1) {
+        return moves->count;
+    }
+
+    for (i = 0; i < moves->count; i++) {
+        apply_move(game, moves->moves[i] / columns, moves->moves[i] % columns,
+		player, &record);
+        nodes += perft(game, plyMoves + 1, depth - 1, other_player(player));
+        undo_move(game, &record);
+    }
+
+    return nodes;
+}
+
+/* Build an opening book from the given starting savefiles, following the
+ * line a search player would play from each for the given number of plies
+ * and searching each position on it to the given depth
+ * Return the exit status of push2310
+ * */
+int book_main(int argc, char** argv, Options* options) {
+    Options bookOptions = *options;
+    BookEntry* entries = NULL;
+    int depth, plies, count = 0, i;
+    Engine engine;
+
+    if (argc < 4 || !parse_number(argv[0], &depth) || depth < 1 ||
+	    !parse_number(argv[1], &plies)) {
+        fprintf(stderr,
+		"Usage: push2310 book depth plies outfile fname ...\n");
+        exit(1);
+    }
+
+    bookOptions.searchDepth = depth;
+    bookOptions.book.data = NULL;
+    init_engine(&engine, &bookOptions);
+    engine.reportMoves = false;
+
+    for (i = 3; i < argc; i++) {
+        FILE* saveFile = fopen(argv[i], "r");
+        Positions* positions;
+        GameState game;
+        char player;
+        int status;
+
+        if (saveFile == NULL) {
+            fprintf(stderr, "No file to load from\n");
+            exit(3);
+        }
+        status = load_savefile(fileno(saveFile), &positions, &player, NULL,
+		NULL);
+        fclose(saveFile);
+        if (status == LOAD_INVALID) {
+            exit_load_error(status);
+        }
+
+        initialise_game(&game, positions, NULL);
+        add_book_line(&game, player, plies, &engine, &entries, &count);
+        free_game(&game);
+    }
+    free_engine(&engine);
+
+    if (!write_book(entries, count, argv[2])) {
+        fprintf(stderr, "Save failed\n");
+        free(entries);
+        return 7;
+    }
+    printf("Book: %d positions\n", count);
+    free(entries);
+    return 0;
+}
+
+/* Add the positions on the line a search player plays from the game for
+ * the given number of plies (or until the game is over) to entries, which
+ * holds count entries and grows as they are added
+ * */
+void add_book_line(GameState* game, char player, int plies,
+	Engine* engine, BookEntry** entries, int* count) {
+    int columns = game->positions->columns, ply;
+    MoveRecord record;
+
+    for (ply = 0; ply < plies && !game_over(game->positions); ply++) {
+        int move = automated_move(game, '2', player, engine);
+
+        /* Powers of two are the sizes the entries are grown at */
+        if ((*count & (*count - 1)) == 0) {
+            *entries = (BookEntry*)realloc(*entries, sizeof(BookEntry) *
+		    (*count == 0 ? 1 : *count * 2));
+        }
+        (*entries)[*count].key = book_key(game, player);
+        (*entries)[*count].move = move;
+        (*entries)[*count].depth = engine->options->searchDepth;
+        (*count)++;
+
+        apply_move(game, move / columns, move % columns, player, &record);
+        player = other_player(player);
+    }
+}
+
+/* Write the given entries to a book file, as a hash table with at least
+ * twice as many slots as entries; the first entry for a key is kept
+ * Return true if the book was saved
+ * */
+bool write_book(BookEntry* entries, int count, char* fileName) {
+    uint64_t slots = 1, mask;
+    unsigned char* data;
+    size_t length;
+    FILE* outputFile;
+    bool saved;
+    int i;
+
+    while (slots < (uint64_t)count * 2) {
+        slots *= 2;
+    }
+    mask = slots - 1;
+    length = BOOK_HEADER + slots * BOOK_ENTRY;
+    data = (unsigned char*)calloc(length, 1);
+    memcpy(data, BOOK_MAGIC, BOOK_MAGIC_LENGTH);
+    data[BOOK_MAGIC_LENGTH] = BOOK_VERSION;
+    write_little_endian(data + 8, slots, 8);
+    for (i = 0; i < (int)slots; i++) {
+        write_little_endian(data + BOOK_HEADER + i * BOOK_ENTRY + 8,
+		BOOK_EMPTY, 4);
+    }
+
+    for (i = 0; i < count; i++) {
+        uint64_t slot = entries[i].key & mask;
+        unsigned char* entry = data + BOOK_HEADER + slot * BOOK_ENTRY;
+
+        while (read_little_endian(entry + 8, 4) != BOOK_EMPTY &&
+		read_little_endian(entry, 8) != entries[i].key) {
+            slot = (slot + 1) & mask;
+            entry = data + BOOK_HEADER + slot * BOOK_ENTRY;
+        }
+        if (read_little_endian(entry + 8, 4) == BOOK_EMPTY) {
+            write_little_endian(entry, entries[i].key, 8);
+            write_little_endian(entry + 8, entries[i].move, 4);
+            write_little_endian(entry + 12, entries[i].depth, 4);
+        }
+    }
+
+    outputFile = fopen(fileName, "wb");
+    saved = outputFile != NULL &&
+	    fwrite(data, 1, length, outputFile) == length;
+    if (outputFile != NULL && fclose(outputFile) != 0) {
+        saved = false;
+    }
+
+    free(data);
+    return saved;
+}
+
+/* Map the book file of the given name into memory, read only and shared so
+ * that every process playing from the book uses the same pages
+ * Return false if the file cannot be mapped or is not a valid book
+ * */
+bool open_book(Book* book, char* fileName) {
+    int fd = open(fileName, O_RDONLY);
+    struct stat info;
+    uint64_t slots;
+
+    book->data = NULL;
+    if (fd < 0) {
+        return false;
+    }
+    if (fstat(fd, &info) != 0 || info.st_size < BOOK_HEADER) {
+        close(fd);
+        return false;
+    }
+
+    book->length = info.st_size;
+    book->data = (unsigned char*)mmap(NULL, book->length, PROT_READ,
+	    MAP_SHARED, fd, 0);
+    close(fd);
+    if (book->data == MAP_FAILED) {
+        book->data = NULL;
+        return false;
+    }
+
+    slots = read_little_endian(book->data + 8, 8);
+    if (memcmp(book->data, BOOK_MAGIC, BOOK_MAGIC_LENGTH) != 0 ||
+	    book->data[BOOK_MAGIC_LENGTH] != BOOK_VERSION || slots == 0 ||
+	    (slots & (slots - 1)) != 0 ||
+	    slots > (book->length - BOOK_HEADER) / BOOK_ENTRY ||
+	    book->length != BOOK_HEADER + slots * BOOK_ENTRY) {
+        munmap(book->data, book->length);
+        book->data = NULL;
+        return false;
+    }
+
+    book->mask = slots - 1;
+    return true;
+}
+
+/* Look the position up in the opening book, if there is one
+ * Return true if the book has a legal move for the position, giving it in
+ * move
+ * */
+bool probe_book(Book* book, GameState* game, char player, int* move) {
+    Positions* positions = game->positions;
+    uint64_t size = (uint64_t)positions->rows * positions->columns;
+    uint64_t key, slot, probes;
+
+    if (book->data == NULL) {
+        return false;
+    }
+
+    key = book_key(game, player);
+    slot = key & book->mask;
+    for (probes = 0; probes <= book->mask; probes++) {
+        unsigned char* entry = book->data + BOOK_HEADER + slot * BOOK_ENTRY;
+        uint64_t bookMove = read_little_endian(entry + 8, 4);
+
+        if (bookMove == BOOK_EMPTY) {
+            return false;
+        }
+        if (read_little_endian(entry, 8) == key) {
+            *move = (int)bookMove;
+            return bookMove < size && valid_position(
+		    *move / positions->columns, *move % positions->columns,
+		    positions);
+        }
+        slot = (slot + 1) & book->mask;
+    }
+
+    return false;
+}
+
+/* Return the key a position is kept under in an opening book, which unlike
+ * position_key also tells apart boards of different sizes and scores
+ * */
+uint64_t book_key(GameState* game, char player) {
+    return position_key(game, player) ^ game->scoreKey;
+}
+
+/* Run a long-lived engine for the given automated player type (the
+ * argument after "engine"), answering one line on stdout for each command
+ * read from stdin, so a caller needing many moves pays for starting the
+ * program and setting up the board only once:
+ * position fname  load the game in a savefile, replying "ok"
+ * move r c        play a move for the player to move, replying "ok"
+ * go [ms]         choose a move for the player to move, thinking for ms
+ *                 (or -t) if it searches, replying "bestmove r c"; the move
+ *                 is not played until a move command plays it
+ * quit            stop the engine, without a reply
+ * Commands which cannot be carried out are answered with "error" and a
+ * reason, and blank lines are ignored
+ * Return the exit status of the program
+ * */
+int engine_main(int argc, char** argv, Options* options) {
+    char reply[REPLY_LENGTH], *line = NULL;
+    EngineSession session;
+    size_t capacity = 0;
+    ssize_t length;
+
+    if (argc != 1 || argv[0][1] != '\0') {
+        fprintf(stderr, "Usage: push2310 engine type\n");
+        exit(1);
+    }
+    if (!valid_player_type(argv[0][0]) || argv[0][0] == 'H') {
+        fprintf(stderr, "Invalid player type\n");
+        exit(2);
+    }
+
+    init_session(&session, options, argv[0][0]);
+    while ((length = getline(&line, &capacity, stdin)) >= 0) {
+        while (length > 0 && (line[length - 1] == '\n' ||
+		line[length - 1] == '\r')) {
+            line[--length] = '\0';
+        }
+        if (length == 0) {
+            continue;
+        }
+        if (!engine_command(&session, line, reply)) {
+            break;
+        }
+        printf("%s\n", reply);
+        fflush(stdout);
+    }
+
+    free(line);
+    free_session(&session);
+    return 0;
+}
+
+/* Set up a session playing the given player type with its own copy of the
+ * options, with no game loaded yet
+ * */
+void init_session(EngineSession* session, Options* options, char type) {
+    session->options = *options;
+    session->options.display = DISPLAY_NONE;
+    init_engine(&session->engine, &session->options);
+    session->engine.reportMoves = false;
+    init_arena(&session->arenas[0]);
+    init_arena(&session->arenas[1]);
+    session->loaded = false;
+    session->player = 'O';
+    session->type = type;
+    session->thinkTime = options->thinkTime;
+    session->scoreKey = 0;
+}
+
+/* Free the game and transposition table of a session
+ * */
+void free_session(EngineSession* session) {
+    session->loaded = false;
+    free_arena(&session->arenas[0]);
+    free_arena(&session->arenas[1]);
+    free_engine(&session->engine);
+}
+
+/* Carry out one command of the engine protocol (see engine_main), given
+ * without its newline, writing the reply (at most REPLY_LENGTH bytes) into
+ * reply
+ * Return false if the command was quit and true otherwise
+ * */
+bool engine_command(EngineSession* session, char* line, char* reply) {
+    char* arguments = strchr(line, ' ');
+
+    if (arguments != NULL) {
+        *arguments++ = '\0';
+        while (*arguments == ' ') {
+            arguments++;
+        }
+    } else {
+        arguments = line + strlen(line);
+    }
+
+    if (strcmp(line, "quit") == 0) {
+        return false;
+    } else if (strcmp(line, "position") == 0) {
+        session_position(session, arguments, reply);
+    } else if (strcmp(line, "move") == 0) {
+        session_move(session, arguments, reply);
+    } else if (strcmp(line, "go") == 0) {
+        session_go(session, arguments, reply);
+    } else {
+        snprintf(reply, REPLY_LENGTH, "error unknown command");
+    }
+    return true;
+}
+
+/* Load the game in the named savefile into the session, replacing any game
+ * it had, and clear the transposition table if the new board differs from
+ * the last one
+ * */
+void session_position(EngineSession* session, char* fileName, char* reply) {
+    int fd = open(fileName, O_RDONLY);
+    Positions* positions;
+    Arena loaded;
+    char player;
+    int status;
+
+    if (fd < 0) {
+        snprintf(reply, REPLY_LENGTH, "error no file to load from");
+        return;
+    }
+    status = load_savefile(fd, &positions, &player, NULL,
+	    &session->arenas[1]);
+    close(fd);
+    if (status == LOAD_INVALID) {
+        reset_arena(&session->arenas[1]);
+        snprintf(reply, REPLY_LENGTH, "error invalid file contents");
+        return;
+    }
+
+    loaded = session->arenas[1];
+    session->arenas[1] = session->arenas[0];
+    session->arenas[0] = loaded;
+    reset_arena(&session->arenas[1]);
+    initialise_game(&session->game, positions, &session->arenas[0]);
+    if (session->game.scoreKey != session->scoreKey) {
+        clear_table(&session->engine.table);
+        session->scoreKey = session->game.scoreKey;
+    }
+
+    session->engine.solveFailed = 0;
+    session->player = player;
+    session->loaded = true;
+    snprintf(reply, REPLY_LENGTH, "ok");
+}
+
+/* Play the move at the row and column given in arguments for the player to
+ * move in the session's game, if it is legal
+ * */
+void session_move(EngineSession* session, char* arguments, char* reply) {
+    int chosenRow, chosenColumn;
+    MoveRecord record;
+    char extra;
+
+    if (!session->loaded) {
+        snprintf(reply, REPLY_LENGTH, "error no position");
+    } else if (sscanf(arguments, "%d %d %c", &chosenRow, &chosenColumn,
+	    &extra) != 2) {
+        snprintf(reply, REPLY_LENGTH, "error usage: move r c");
+    } else if (game_over(session->game.positions) ||
+	    !valid_position(chosenRow, chosenColumn,
+	    session->game.positions)) {
+        snprintf(reply, REPLY_LENGTH, "error illegal move");
+    } else {
+        apply_move(&session->game, chosenRow, chosenColumn, session->player,
+		&record);
+        session->player = other_player(session->player);
+        snprintf(reply, REPLY_LENGTH, "ok");
+    }
+}
+
+/* Choose the move the session's player type makes for the player to move,
+ * thinking for the time given in arguments if there is one, without
+ * playing it
+ * */
+void session_go(EngineSession* session, char* arguments, char* reply) {
+    int thinkTime = session->thinkTime, move;
+
+    if (*arguments != '\0' && (!parse_number(arguments, &thinkTime) ||
+	    thinkTime < 1)) {
+        snprintf(reply, REPLY_LENGTH, "error usage: go [ms]");
+    } else if (!session->loaded) {
+        snprintf(reply, REPLY_LENGTH, "error no position");
+    } else if (game_over(session->game.positions)) {
+        snprintf(reply, REPLY_LENGTH, "error game over");
+    } else {
+        session->options.thinkTime = thinkTime;
+        move = automated_move(&session->game, session->type,
+		session->player, &session->engine);
+        snprintf(reply, REPLY_LENGTH, "bestmove %d %d",
+		move / session->game.positions->columns,
+		move % session->game.positions->columns);
+    }
+}
+
+/* Serve games of the given automated player type over the Unix domain
+ * socket at the given path (the arguments after "serve") until killed
+ * Each connection plays its own game through the engine protocol (see
+ * engine_main), with its lines carried out in order by -j workers which
+ * each search on one thread; every connection has its own transposition
+ * table of -m megabytes once it first searches, so hosting many games at
+ * once calls for a small -m
+ * */
+int serve_main(int argc, char** argv, Options* options) {
+    struct epoll_event events[SERVER_EVENTS];
+    pthread_t thread;
+    Server server;
+    int count, i;
+
+    if (argc != 2 || argv[0][1] != '\0') {
+        fprintf(stderr, "Usage: push2310 serve type socket\n");
+        exit(1);
+    }
+    if (!valid_player_type(argv[0][0]) || argv[0][0] == 'H') {
+        fprintf(stderr, "Invalid player type\n");
+        exit(2);
+    }
+
+    memset(&server, 0, sizeof(Server));
+    server.options = *options;
+    server.options.threads = 1;
+    server.type = argv[0][0];
+    pthread_mutex_init(&server.lock, NULL);
+    pthread_cond_init(&server.work, NULL);
+    if (!open_listener(&server, argv[1])) {
+        fprintf(stderr, "Cannot listen on socket\n");
+        exit(3);
+    }
+    server.connectionLimit = connection_limit(&server, options->threads);
+
+    for (i = 0; i < options->threads; i++) {
+        if (pthread_create(&thread, NULL, run_server_worker, &server) == 0) {
+            pthread_detach(thread);
+        }
+    }
+
+    while (true) {
+        count = epoll_wait(server.epoll, events, SERVER_EVENTS,
+		server.paused ? SERVER_RETRY : -1);
+        if (count == 0 && server.paused) {
+            watch_listener(&server, true);
+        }
+        for (i = 0; i < count; i++) {
+            ServerConnection* connection = events[i].data.ptr;
+
+            if (connection == NULL) {
+                accept_connections(&server);
+            } else if (connection == (ServerConnection*)&server) {
+                finish_lines(&server);
+            } else if (connection->fd >= 0) {
+                if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+                    read_connection(&server, connection);
+                } else {
+                    advance_connection(&server, connection);
+                }
+            }
+        }
+    }
+}
+
+/* Set up the server's event loop, listening on a Unix domain socket at the
+ * given path (replacing any socket left there) and for its workers'
+ * wakeups
+ * Return false if the socket could not be listened on
+ * */
+bool open_listener(Server* server, char* path) {
+    struct sockaddr_un address;
+    struct epoll_event event;
+    struct stat info;
+
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        return false;
+    }
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, path);
+    if (stat(path, &info) == 0 && S_ISSOCK(info.st_mode)) {
+        unlink(path);
+    }
+
+    server->listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (server->listener < 0 || bind(server->listener,
+	    (struct sockaddr*)&address, sizeof(address)) != 0 ||
+	    listen(server->listener, SOMAXCONN) != 0) {
+        return false;
+    }
+    fcntl(server->listener, F_SETFL, O_NONBLOCK);
+
+    server->epoll = epoll_create1(0);
+    server->wakeup = eventfd(0, EFD_NONBLOCK);
+    if (server->epoll < 0 || server->wakeup < 0) {
+        return false;
+    }
+
+    event.events = EPOLLIN;
+    event.data.ptr = NULL;
+    epoll_ctl(server->epoll, EPOLL_CTL_ADD, server->listener, &event);
+    event.data.ptr = server;
+    epoll_ctl(server->epoll, EPOLL_CTL_ADD, server->wakeup, &event);
+    return true;
+}
+
+/* Accept every connection waiting on the server's socket, each starting
+ * with no game loaded
+ * Once the server reaches its connection limit or runs out of file
+ * descriptors the rest are left waiting, and the socket is not watched (so
+ * the loop does not spin on it) until a connection closes or SERVER_RETRY
+ * ms pass
+ * */
+void accept_connections(Server* server) {
+    ServerConnection* connection;
+    int fd;
+
+    while (server->connections < server->connectionLimit) {
+        fd = accept(server->listener, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS ||
+		    errno == ENOMEM) {
+                watch_listener(server, false);
+            }
+            if (errno != EINTR) {
+                return;
+            }
+            continue;
+        }
+
+        fcntl(fd, F_SETFL, O_NONBLOCK);
+        connection = new_connection(server);
+        connection->fd = fd;
+        server->connections++;
+        watch_connection(server, connection);
+    }
+
+    watch_listener(server, false);
+}
+
+/* Start or stop watching the server's socket for connections
+ * */
+void watch_listener(Server* server, bool watch) {
+    struct epoll_event event;
+
+    event.events = watch ? EPOLLIN : 0;
+    event.data.ptr = NULL;
+    epoll_ctl(server->epoll, EPOLL_CTL_MOD, server->listener, &event);
+    server->paused = !watch;
+}
+
+/* Work out how many connections the server can hold open within its limit
+ * on file descriptors, keeping one for each of the given number of workers
+ * and the ones it already has
+ * Return the limit on connections
+ * */
+int connection_limit(Server* server, int workers) {
+    int inUse = server->listener;
+    struct rlimit limit;
+
+    if (server->epoll > inUse) {
+        inUse = server->epoll;
+    }
+    if (server->wakeup > inUse) {
+        inUse = server->wakeup;
+    }
+    if (getrlimit(RLIMIT_NOFILE, &limit) != 0 ||
+	    limit.rlim_cur == RLIM_INFINITY || limit.rlim_cur > INT_MAX) {
+        return INT_MAX;
+    }
+    if ((int)limit.rlim_cur - inUse - 1 - workers < 1) {
+        return 1;
+    }
+    return (int)limit.rlim_cur - inUse - 1 - workers;
+}
+
+/* Take a connection from the free list, first filling the list with a new
+ * slab of SERVER_SLAB connections if it is empty
+ * The connection keeps the transposition table (and the board it was
+ * filled for) of the last connection to use it
+ * Return the connection, with empty input and output
+ * */
+ServerConnection* new_connection(Server* server) {
+    ServerConnection* connection;
+    int i;
+
+    if (server->free == NULL) {
+        ServerConnection* slab = (ServerConnection*)calloc(SERVER_SLAB,
+		sizeof(ServerConnection));
+
+        /* Powers of two are the sizes the list of slabs is grown at */
+        if ((server->slabCount & (server->slabCount - 1)) == 0) {
+            server->slabs = (ServerConnection**)realloc(server->slabs,
+		    sizeof(ServerConnection*) * (server->slabCount == 0 ? 1 :
+		    server->slabCount * 2));
+        }
+        server->slabs[server->slabCount++] = slab;
+
+        for (i = SERVER_SLAB - 1; i >= 0; i--) {
+            init_session(&slab[i].session, &server->options, server->type);
+            slab[i].fd = -1;
+            slab[i].next = server->free;
+            server->free = &slab[i];
+        }
+    }
+
+    connection = server->free;
+    server->free = connection->next;
+    connection->next = NULL;
+    connection->inputLength = 0;
+    connection->outputLength = 0;
+    connection->busy = false;
+    connection->ended = false;
+    connection->quit = false;
+    connection->events = 0;
+    return connection;
+}
+
+/* Close a connection which no worker is using, giving back its game's
+ * arena and putting it back on the free list
+ * */
+void close_connection(Server* server, ServerConnection* connection) {
+    if (connection->events != 0) {
+        epoll_ctl(server->epoll, EPOLL_CTL_DEL, connection->fd, NULL);
+    }
+    close(connection->fd);
+    connection->fd = -1;
+    connection->session.loaded = false;
+    reset_arena(&connection->session.arenas[0]);
+    server->connections--;
+    if (server->paused) {
+        watch_listener(server, true);
+    }
+
+    connection->next = server->free;
+    server->free = connection;
+}
+
+/* Read as much of a connection's input as there is room for, noting when
+ * the client has sent all it will, then carry on with the connection
+ * */
+void read_connection(Server* server, ServerConnection* connection) {
+    while (!connection->ended && connection->inputLength < SERVER_INPUT) {
+        ssize_t length = read(connection->fd, connection->input +
+		connection->inputLength, SERVER_INPUT -
+		connection->inputLength);
+
+        if (length > 0) {
+            connection->inputLength += length;
+        } else if (length < 0 && errno == EINTR) {
+            continue;
+        } else {
+            connection->ended = length == 0 || (errno != EAGAIN &&
+		    errno != EWOULDBLOCK);
+            break;
+        }
+    }
+
+    advance_connection(server, connection);
+}
+
+/* Move a connection on as far as it can go without waiting: send its
+ * reply, then hand its next line to the workers, or close it once it has
+ * quit or its client has nothing more to send (or sends a line longer than
+ * SERVER_INPUT)
+ * */
+void advance_connection(Server* server, ServerConnection* connection) {
+    char* newline;
+
+    if (!flush_connection(connection)) {
+        if (!connection->busy) {
+            close_connection(server, connection);
+        }
+        return;
+    }
+    if (connection->busy || connection->outputLength > 0) {
+        watch_connection(server, connection);
+        return;
+    }
+
+    while (!connection->quit) {
+        newline = (char*)memchr(connection->input, '\n',
+		connection->inputLength);
+        if (newline == NULL) {
+            if (!connection->ended &&
+		    connection->inputLength < SERVER_INPUT) {
+                watch_connection(server, connection);
+                return;
+            }
+            break;
+        }
+
+        connection->lineLength = newline - connection->input + 1;
+        *newline = '\0';
+        if (newline > connection->input && newline[-1] == '\r') {
+            newline[-1] = '\0';
+        }
+        if (connection->input[0] != '\0') {
+            connection->busy = true;
+            pthread_mutex_lock(&server->lock);
+            if (server->ready == NULL) {
+                server->ready = connection;
+            } else {
+                server->readyTail->next = connection;
+            }
+            server->readyTail = connection;
+            pthread_cond_signal(&server->work);
+            pthread_mutex_unlock(&server->lock);
+            watch_connection(server, connection);
+            return;
+        }
+
+        connection->inputLength -= connection->lineLength;
+        memmove(connection->input, newline + 1, connection->inputLength);
+    }
+
+    close_connection(server, connection);
+}
+
+/* Send as much of a connection's reply as the client will take
+ * Return false if the connection has failed and true otherwise
+ * */
+bool flush_connection(ServerConnection* connection) {
+    while (connection->outputLength > 0) {
+        ssize_t sent = send(connection->fd, connection->output,
+		connection->outputLength, MSG_NOSIGNAL);
+
+        if (sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        connection->outputLength -= sent;
+        memmove(connection->output, connection->output + sent,
+		connection->outputLength);
+    }
+
+    return true;
+}
+
+/* Watch a connection for what it is waiting on: input while it has room
+ * for it and the client has more to send, and the client taking its reply
+ * A connection waiting on neither (as its line is with a worker) is taken
+ * out of the epoll set, so a client hanging up cannot wake the loop
+ * */
+void watch_connection(Server* server, ServerConnection* connection) {
+    struct epoll_event event;
+
+    event.events = 0;
+    if (!connection->ended && connection->inputLength < SERVER_INPUT) {
+        event.events |= EPOLLIN;
+    }
+    if (connection->outputLength > 0) {
+        event.events |= EPOLLOUT;
+    }
+    event.data.ptr = connection;
+
+    if (event.events == connection->events) {
+        return;
+    }
+    if (connection->events == 0) {
+        epoll_ctl(server->epoll, EPOLL_CTL_ADD, connection->fd, &event);
+    } else if (event.events == 0) {
+        epoll_ctl(server->epoll, EPOLL_CTL_DEL, connection->fd, NULL);
+    } else {
+        epoll_ctl(server->epoll, EPOLL_CTL_MOD, connection->fd, &event);
+    }
+    connection->events = event.events;
+}
+
+/* Take back the connections whose line the workers have finished, queue
+ * their replies and carry on with each
+ * */
+void finish_lines(Server* server) {
+    ServerConnection* connection;
+    uint64_t wakeups;
+
+    if (read(server->wakeup, &wakeups, sizeof(wakeups)) < 0) {
+        return;
+    }
+
+    pthread_mutex_lock(&server->lock);
+    connection = server->done;
+    server->done = NULL;
+    pthread_mutex_unlock(&server->lock);
+
+    while (connection != NULL) {
+        ServerConnection* next = connection->next;
+
+        connection->next = NULL;
+        connection->busy = false;
+        connection->inputLength -= connection->lineLength;
+        memmove(connection->input, connection->input +
+		connection->lineLength, connection->inputLength);
+        if (!connection->quit) {
+            connection->outputLength = snprintf(connection->output,
+		    sizeof(connection->output), "%s\n", connection->reply);
+        }
+        advance_connection(server, connection);
+        connection = next;
+    }
+}
+
+/* Carry out the lines of the connections queued on the server, one at a
+ * time, for as long as the server runs
+ * */
+void* run_server_worker(void* server) {
+    Server* shared = (Server*)server;
+    uint64_t wakeup = 1;
+
+    while (true) {
+        ServerConnection* connection;
+
+        pthread_mutex_lock(&shared->lock);
+        while (shared->ready == NULL) {
+            pthread_cond_wait(&shared->work, &shared->lock);
+        }
+        connection = shared->ready;
+        shared->ready = connection->next;
+        pthread_mutex_unlock(&shared->lock);
+
+        connection->quit = !engine_command(&connection->session,
+		connection->input, connection->reply);
+
+        pthread_mutex_lock(&shared->lock);
+        connection->next = shared->done;
+        shared->done = connection;
+        pthread_mutex_unlock(&shared->lock);
+        while (write(shared->wakeup, &wakeup, sizeof(wakeup)) < 0 &&
+		errno == EINTR) {
+            continue;
+        }
+    }
+
+    return NULL;
+}
+
+/* Allocate a transposition table of at most the given size, with a power
+ * of two number of entries, halving it until the allocation succeeds
+ * */
+void init_table(TranspositionTable* table, int megabytes) {
+    size_t bytes = (size_t)megabytes << 20, count = 1;
+
+    while (count * 2 * sizeof(TableEntry) <= bytes) {
+        count *= 2;
+    }
+
+    table->entries = (TableEntry*)calloc(count, sizeof(TableEntry));
+    while (table->entries == NULL && count > 1) {
+        count /= 2;
+        table->entries = (TableEntry*)calloc(count, sizeof(TableEntry));
+    }
+
+    table->mask = count - 1;
+    table->age = 0;
+}
+
+/* Free the entries of a transposition table, if it was ever allocated
+ * */
+void free_table(TranspositionTable* table) {
+    free(table->entries);
+    table->entries = NULL;
+}
+
+/* Forget every entry of a transposition table, if it was ever allocated,
+ * keeping its memory for the searches which follow
+ * */
+void clear_table(TranspositionTable* table) {
+    if (table->entries != NULL) {
+        memset(table->entries, 0, sizeof(TableEntry) * (table->mask + 1));
+    }
+    table->age = 0;
+}
+
+/* Look up the position with the given key in the transposition table
+ * Return true and fill in hit if the table holds the position, or false
+ * otherwise
+ * */
+bool probe_table(TranspositionTable* table, uint64_t key, TableHit* hit) {
+    TableEntry* entry = &table->entries[key & table->mask];
+    uint64_t lock = __atomic_load_n(&entry->lock, __ATOMIC_RELAXED);
+    uint64_t data = __atomic_load_n(&entry->data, __ATOMIC_RELAXED);
+
+    if ((lock & 3) == 0 || (lock ^ data) >> ENTRY_INFO_BITS !=
+	    key >> ENTRY_INFO_BITS) {
+        return false;
+    }
+
+    hit->bound = lock & 3;
+    hit->depth = (lock >> 2) & 0xff;
+    hit->value = (int32_t)(uint32_t)data;
+    hit->move = (int32_t)(uint32_t)(data >> 32);
+    return true;
+}
+
+/* Store the result of searching the position with the given key
+ * An entry from the current search is only replaced by a result at least
+ * as deep, while entries from earlier searches are always replaced
+ * */
+void store_table(TranspositionTable* table, uint64_t key, int depth,
+	int bound, int value, int move) {
+    TableEntry* entry = &table->entries[key & table->mask];
+    uint64_t lock = __atomic_load_n(&entry->lock, __ATOMIC_RELAXED);
+    uint64_t age = table->age & 63, data;
+
+    if (depth > 0xff) {
+        depth = 0xff;
+    }
+
+    if ((lock & 3) != 0 && ((lock >> 10) & 63) == age &&
+	    (int)((lock >> 2) & 0xff) > depth) {
+        return;
+    }
+
+    data = (uint64_t)(uint32_t)value | (uint64_t)(uint32_t)move << 32;
+    lock = ((key ^ data) & ~(((uint64_t)1 << ENTRY_INFO_BITS) - 1)) |
+	    age << 10 | (uint64_t)depth << 2 | (uint64_t)bound;
+    __atomic_store_n(&entry->lock, lock, __ATOMIC_RELAXED);
+    __atomic_store_n(&entry->data, data, __ATOMIC_RELAXED);
+}
+
+/* Return the Zobrist key of the given stone at the position with the given
+ * index, mixing the two together (with splitmix64) rather than looking the
+ * key up in a table, so boards of any size need no extra memory
+ * */
+uint64_t zobrist_key(int index, char stone) {
+    uint64_t z = ((uint64_t)index * 2 + (stone == 'X') + 1) *
+	    0x9e3779b97f4a7c15ULL;
+
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+/* Return the key of the current position with the given player to move
+ * */
+uint64_t position_key(GameState* game, char player) {
+    return player == 'X' ? game->hash ^ SIDE_KEY : game->hash;
+}
+
+/* Set up a copy of the given game on its own copy of the positions, in the
+ * given arena or on the heap if it is NULL
+ * */
+void copy_game(GameState* copy, GameState* game, Arena* arena) {
+    *copy = *game;
+    copy->positions = copy_positions(game->positions, arena);
+    init_move_list(&copy->moves, copy->positions, arena);
+}
+
+/* Free the positions and move list of a game on the heap
+ * */
+void free_game(GameState* game) {
+    free_move_list(&game->moves);
+    free_positions(game->positions);
+}
+
+/* Set up the state of a game played on the given positions, totalling
+ * each player's starting score, hashing the starting board and
+ * checksumming its scores
+ * Its move list is allocated from the given arena, or the heap if it is
+ * NULL
+ * */
+void initialise_game(GameState* game, Positions* positions, Arena* arena) {
+    game->positions = positions;
+    game->oScore = plane_score(positions, positions->oPlane);
+    game->xScore = plane_score(positions, positions->xPlane);
+    game->hash = plane_hash(positions, positions->oPlane, 'O') ^
+	    plane_hash(positions, positions->xPlane, 'X');
+    game->scoreKey = binary_checksum(positions->scores,
+	    (size_t)positions->rows * positions->columns) ^
+	    zobrist_key(positions->rows, 'O') ^
+	    zobrist_key(positions->columns, 'X');
+    init_move_list(&game->moves, positions, arena);
+}
+
+/* Initiate game play
+ * Prompt for the correct move type depending on player types, with a search
+ * player pondering its reply while a human player chooses their move
+ * Update and display the board after each move (or as often as the output
+ * mode asks)
+ * Print the winner of the game once the game is over
+ * */
+void play_game(BoardText* text, GameState* game, char pOType, char pXType,
+	char* currentPlayer, Engine* engine) {
+    Positions* positions = game->positions;
+    int display = engine->options->display, moves = 0;
+    Ponder ponder;
+
+    while (!game_over(positions)) {
+        if (*currentPlayer == 'O' && pOType == 'H') {
+            start_ponder(&ponder, game, 'X', pXType, engine);
+            human_o_move(text, game, currentPlayer, &engine->arenas[0]);
+            finish_ponder(&ponder, game, engine);
+            reset_arena(&engine->arenas[0]);
+        } else if (*currentPlayer == 'X' && pXType == 'H') {
+            start_ponder(&ponder, game, 'O', pOType, engine);
+            human_x_move(text, game, currentPlayer, &engine->arenas[0]);
+            finish_ponder(&ponder, game, engine);
+            reset_arena(&engine->arenas[0]);
+        } else if (*currentPlayer == 'O' && pOType != 'H') {
+            automated_o_move(game, pOType, currentPlayer, engine);
+	} else {
+            automated_x_move(game, pXType, currentPlayer, engine);
+        }
+
+        text->stale = true;
+        moves++;
+        if (display > 0 && (moves % display == 0 || game_over(positions))) {
+            display_board(text, positions);
+        }
+    }
+
+    if (display == DISPLAY_FINAL) {
+        display_board(text, positions);
+    }
+    display_winners(game);
+    STATS_REPORT();
+}
+
+/* Bring the text of the board up to date with the positions
+ * */
+void render_board(BoardText* text, Positions* positions) {
+    render_rows(positions, 0, positions->rows, text->text);
+    text->stale = false;
+}
+
+/* Render the text of the rows from firstRow up to (not including) lastRow
+ * into out, one line of columns * 2 characters and a newline per row
+ * */
+void render_rows(Positions* positions, int firstRow, int lastRow,
+	char* out) {
+    size_t line = (size_t)positions->columns * 2 + 1;
+    int r, c;
+
+    for (r = firstRow; r < lastRow; r++, out += line) {
+        uint64_t* oRow = plane_row(positions, positions->oPlane, r);
+        uint64_t* xRow = plane_row(positions, positions->xPlane, r);
+        uint64_t* emptyRow = plane_row(positions, positions->emptyPlane, r);
+        unsigned char* scores = positions->scores + (size_t)r *
+		positions->columns;
+
+        for (c = 0; c < positions->columns; c++) {
+            uint64_t bit = (uint64_t)1 << (c % PLANE_BITS);
+            int word = c / PLANE_BITS;
+
+            if (oRow[word] & bit) {
+                out[c * 2 + 1] = 'O';
+            } else if (xRow[word] & bit) {
+                out[c * 2 + 1] = 'X';
+            } else if (emptyRow[word] & bit) {
+                out[c * 2 + 1] = '.';
+            } else {
+                out[c * 2] = ' ';
+                out[c * 2 + 1] = ' ';
+                continue;
+            }
+            out[c * 2] = scores[c] + '0';
+        }
+        out[line - 1] = '\n';
+    }
+}
+
+/* Write the text of the board to out a few rows at a time (at most
+ * RENDER_CHUNK bytes, or a single row), for boards whose text is not kept
+ * Return false if the text could not all be written
+ * */
+bool write_board(Positions* positions, FILE* out) {
+    size_t line = (size_t)positions->columns * 2 + 1;
+    int chunkRows = RENDER_CHUNK / line > 0 ? RENDER_CHUNK / line : 1;
+    char* buffer = (char*)malloc(line * chunkRows);
+    bool written = true;
+    int r;
+
+    for (r = 0; r < positions->rows && written; r += chunkRows) {
+        int lastRow = r + chunkRows < positions->rows ?
+		r + chunkRows : positions->rows;
+
+        render_rows(positions, r, lastRow, buffer);
+        written = fwrite(buffer, 1, line * (lastRow - r), out) ==
+		line * (lastRow - r);
+    }
+
+    free(buffer);
+    return written;
+}
+
+/* Print the current board, with a single write of the board's text, or a
+ * few rows at a time when its text is not kept
+ * */
+void display_board(BoardText* text, Positions* positions) {
+    if (text->text == NULL) {
+        write_board(positions, stdout);
+        fflush(stdout);
+        return;
+    }
+
+    if (text->stale) {
+        render_board(text, positions);
+    }
+
+    fflush(stdout);
+    write_all(STDOUT_FILENO, text->text, text->length);
+}
+
+/* Write all of the given data to a file descriptor, retrying writes which
+ * are interrupted or only partly complete
+ * */
+void write_all(int fd, char* data, size_t length) {
+    while (length > 0) {
+        ssize_t written = write(fd, data, length);
+
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        data += written;
+        length -= written;
+    }
+}
+
+/* Carry out a move for player O when they are an automated player
+ * */
+void automated_o_move(GameState* game, char pOType, char* currentPlayer,
+	Engine* engine) {
+    Positions* positions = game->positions;
+    MoveRecord move;
+    int chosenIndex = automated_move(game, pOType, *currentPlayer, engine);
+    int chosenRow = chosenIndex / positions->columns;
+    int chosenColumn = chosenIndex % positions->columns;
+
+    apply_move(game, chosenRow, chosenColumn, *currentPlayer, &move);
+    if (engine->options->display > 0) {
+        printf("Player %c placed at %d %d\n", *currentPlayer, chosenRow,
+		chosenColumn);
+    }
+
+    *currentPlayer = 'X';
+}
+
+/* Carry out a move for player X when they are an automated player
+ * */
+void automated_x_move(GameState* game, char pXType, char* currentPlayer,
+	Engine* engine) {
+    Positions* positions = game->positions;
+    MoveRecord move;
+    int chosenIndex = automated_move(game, pXType, *currentPlayer, engine);
+    int chosenRow = chosenIndex / positions->columns;
+    int chosenColumn = chosenIndex % positions->columns;
+
+    apply_move(game, chosenRow, chosenColumn, *currentPlayer, &move);
+    if (engine->options->display > 0) {
+        printf("Player %c placed at %d %d\n", *currentPlayer, chosenRow,
+		chosenColumn);
+    }
+
+    *currentPlayer = 'O';
+}
+
+/* Choose the move an automated player of the given type makes
+ * Type 0 players take the first empty interior position if they are player
+ * O, and the last if they are player X
+ * Search players (types 2 and 3) play the book move while the position is
+ * in the opening book, then the solved move once the endgame can be solved
+ * exactly, and only search if neither has a move (or pondering has already
+ * found it)
+ * Scratch memory for the move comes from the engine's arenas, which are
+ * reset once it is chosen
+ * Return the index of the position to be played
+ * */
+int automated_move(GameState* game, char type, char player, Engine* engine) {
+    int move, margin, i;
+#ifdef STATS
+    double start = now_ms();
+    long long nodes = __atomic_load_n(&stats.nodes, __ATOMIC_RELAXED);
+    long long bytes = __atomic_load_n(&stats.allocatedBytes,
+	    __ATOMIC_RELAXED);
+#endif
+
+    if (type == '0') {
+        move = type0(game, player);
+    } else if (type == '1') {
+        int* chosenPosition = type1(game, &player, &engine->arenas[0]);
+        move = chosenPosition[0] * game->positions->columns +
+		chosenPosition[1];
+    } else if (!probe_book(&engine->options->book, game, player, &move) &&
+	    !solve_endgame(game, player, engine, &move, &margin)) {
+        if (type == '2' && engine->ponderMove >= 0) {
+            move = engine->ponderMove;
+        } else if (type == '2') {
+            move = search_move(game, player, engine);
+        } else {
+            move = mcts_move(game, player, engine);
+        }
+    }
+    engine->ponderMove = -1;
+    for (i = 0; i < engine->options->threads; i++) {
+        reset_arena(&engine->arenas[i]);
+    }
+
+#ifdef STATS
+    record_move(player, start, nodes, bytes);
+#endif
+    return move;
+}
+
+/* Find the move a type 0 player makes, found from the empty positions
+ * nearest the ends of each row rather than by generating every move
+ * Return the index of the position to be played
+ * */
+int type0(GameState* game, char player) {
+    Positions* positions = game->positions;
+    int rows = positions->rows, columns = positions->columns, r;
+
+    if (player == 'O') {
+        for (r = 1; r < rows - 1; r++) {
+            if (positions->rowFirstEmpty[r] < columns - 1) {
+                return r * columns + positions->rowFirstEmpty[r];
+            }
+        }
+    } else {
+        for (r = rows - 2; r > 0; r--) {
+            if (positions->rowLastEmpty[r] > 0) {
+                return r * columns + positions->rowLastEmpty[r];
+            }
+        }
+    }
+
+    return -1;
+}
+
+/* Find a valid type 1 move for automated players
+ * Take the first push (going clockwise from the top left) which lowers the
+ * opponent's score, otherwise the highest scoring legal move, preferring
+ * the first in row major order
+ * Return an array of the coordinates of the position to be played, allocated
+ * from the given arena
+ * */
+int* type1(GameState* game, char* currentPlayer, Arena* arena) {
+    Positions* positions = game->positions;
+    MoveList* moves = &game->moves;
+    int columns = positions->columns;
+    int i, *chosenPosition = (int*)arena_alloc(arena, sizeof(int) * 2);
+
+    generate_moves(game, moves);
+    for (i = 0; i < moves->edgeCount; i++) {
+        int row = moves->moves[i] / columns;
+        int column = moves->moves[i] % columns;
+
+        if (decrease_score(game, row, column, currentPlayer)) {
+            chosenPosition[0] = row;
+            chosenPosition[1] = column;
+            return chosenPosition;
+        }
+    }
+
+    /* A move must beat the score of the top left corner to be chosen, so
+     * fall back to the first legal move if none does */
+    int highScore = positions->scores[0], chosenIndex = moves->moves[0];
+    bool found = false;
+    for (i = 0; i < moves->count; i++) {
+        int index = moves->moves[i], score = positions->scores[index];
+
+        if (score > highScore || (found && score == highScore &&
+		index < chosenIndex)) {
+            highScore = score;
+            chosenIndex = index;
+            found = true;
+        }
+    }
+
+    chosenPosition[0] = chosenIndex / columns;
+    chosenPosition[1] = chosenIndex % columns;
+    return chosenPosition;
+}
+
+/* Search for the best move for the given player with iterative deepening
+ * negamax alpha-beta, stopping once the engine's think time has passed
+ * Helper threads (Lazy SMP) search the same position on copies of the game
+ * at the same time, sharing what they find through the transposition table,
+ * and the move of whichever thread completed the deepest iteration is
+ * played, preferring the main thread's
+ * In a fixed depth search only one thread is used and the clock is ignored,
+ * so the move chosen never depends on timing or the number of threads
+ * Return the index of the position to be played
+ * */
+int search_move(GameState* game, char player, Engine* engine) {
+    Options* options = engine->options;
+    int maxDepth = count_empty(game->positions), threads = options->threads;
+    int bestMove, bestDepth, i;
+    SearchThread* helpers;
+    Search search;
+    bool finished = false;
+
+    if (engine->table.entries == NULL) {
+        init_table(&engine->table, options->tableSize);
+    }
+    engine->table.age++;
+
+    if (maxDepth > MAX_SEARCH_DEPTH) {
+        maxDepth = MAX_SEARCH_DEPTH;
+    }
+    if (options->searchDepth > 0) {
+        threads = 1;
+        if (maxDepth > options->searchDepth) {
+            maxDepth = options->searchDepth;
+        }
+    }
+
+    init_search(&search, game, engine, &finished, 1, &engine->arenas[0]);
+    helpers = (SearchThread*)arena_alloc(&engine->arenas[0],
+	    sizeof(SearchThread) * threads);
+    for (i = 1; i < threads; i++) {
+        copy_game(&helpers[i].game, game, &engine->arenas[0]);
+        init_search(&helpers[i].search, &helpers[i].game, engine, &finished,
+		1 + i % 2, &engine->arenas[i]);
+        helpers[i].player = player;
+        helpers[i].maxDepth = maxDepth;
+        helpers[i].started = pthread_create(&helpers[i].thread, NULL,
+		run_helper, &helpers[i]) == 0;
+    }
+
+    iterate_search(&search, player, maxDepth);
+    __atomic_store_n(&finished, true, __ATOMIC_RELAXED);
+
+    bestMove = search.bestMove;
+    bestDepth = search.completedDepth;
+    for (i = 1; i < threads; i++) {
+        if (helpers[i].started) {
+            pthread_join(helpers[i].thread, NULL);
+            if (helpers[i].search.completedDepth > bestDepth) {
+                bestMove = helpers[i].search.bestMove;
+                bestDepth = helpers[i].search.completedDepth;
+            }
+        }
+    }
+
+    return bestMove;
+}
+
+/* Solve the endgame for the given player once no more than the engine's
+ * solveEmpties interior positions are empty, searching every line to the
+ * end of the game with alpha-beta
+ * Solved positions are kept in the transposition table at SOLVED_DEPTH, so
+ * later solves and searches reuse them
+ * The solve may take half the think time, leaving the rest to a search if
+ * it does not finish; when moves must not depend on timing (a fixed depth
+ * or number of playouts) it is limited to SOLVE_NODE_LIMIT nodes instead
+ * After a solve fails no other is tried until SOLVE_RETRY_MOVES more moves
+ * have been played, or a game with more empty positions is started
+ * Return true if the endgame was solved, with the best move in move and the
+ * final margin it guarantees (the player's score minus their opponent's)
+ * in margin
+ * */
+bool solve_endgame(GameState* game, char player, Engine* engine, int* move,
+	int* margin) {
+    Options* options = engine->options;
+    int columns = game->positions->columns, alpha = -INT_MAX, i;
+    int empty = count_empty(game->positions);
+    bool finished = false, solved;
+    double start = now_ms();
+    MoveRecord record;
+    ScoredMove* order;
+    MoveList* moves;
+    Search search;
+
+    if (options->solveEmpties == 0 ||
+	    game->positions->interiorEmpties > options->solveEmpties ||
+	    (empty <= engine->solveFailed &&
+	    empty > engine->solveFailed - SOLVE_RETRY_MOVES)) {
+        return false;
+    }
+
+    if (engine->table.entries == NULL) {
+        init_table(&engine->table, options->tableSize);
+    }
+    engine->table.age++;
+
+    init_search(&search, game, engine, &finished, 0, &engine->arenas[0]);
+    if (options->searchDepth > 0 || options->playouts > 0) {
+        search.deadline = DBL_MAX;
+        search.nodeLimit = SOLVE_NODE_LIMIT;
+    } else {
+        search.deadline = start + options->thinkTime / 2.0;
+    }
+
+    prepare_ply(&search, 0);
+    moves = &search.plyMoves[0];
+    order = search.plyOrder[0];
+    generate_moves(game, moves);
+    order_moves(&search, moves, order, player);
+
+    for (i = 0; i < moves->count && !search.stopped; i++) {
+        int value;
+
+        apply_move(game, order[i].move / columns, order[i].move % columns,
+		player, &record);
+        value = -solve(&search, -INT_MAX, -alpha, other_player(player), 1);
+        undo_move(game, &record);
+
+        if (!search.stopped && value > alpha) {
+            alpha = value;
+            *move = order[i].move;
+        }
+    }
+
+    solved = !search.stopped && moves->count > 0;
+    engine->solveFailed = solved ? 0 : empty;
+    if (solved) {
+        *margin = alpha;
+        if (engine->reportMoves) {
+            fprintf(stderr, "Player %c solved the endgame with a margin of "
+		    "%d (%ld nodes in %.0f ms)\n", player, alpha, search.nodes,
+		    now_ms() - start);
+        }
+    }
+
+    return solved;
+}
+
+/* Solve the current position to the end of the game with alpha-beta
+ * pruning, taking positions already solved from the transposition table
+ * The search stops if the game runs on past MAX_SEARCH_DEPTH moves, as
+ * there are no more plies to search with
+ * Return the final margin of the position for the given player
+ * */
+int solve(Search* search, int alpha, int beta, char player, int ply) {
+    GameState* game = search->game;
+    MoveList* moves;
+    ScoredMove* order;
+    MoveRecord record;
+    TableHit hit;
+    uint64_t key;
+    int columns = game->positions->columns, best = -INT_MAX, i;
+    int originalAlpha = alpha, bestMove = -1, bound;
+
+    if (out_of_time(search)) {
+        return 0;
+    }
+
+    key = position_key(game, player);
+    hit.move = -1;
+    if (probe_table(search->table, key, &hit) && hit.depth == SOLVED_DEPTH &&
+	    (hit.bound == BOUND_EXACT ||
+	    (hit.bound == BOUND_LOWER && hit.value >= beta) ||
+	    (hit.bound == BOUND_UPPER && hit.value <= alpha))) {
+        return hit.value;
+    }
+
+    if (ply > MAX_SEARCH_DEPTH) {
+        search->stopped = true;
+        return 0;
+    }
+
+    prepare_ply(search, ply);
+    moves = &search->plyMoves[ply];
+    order = search->plyOrder[ply];
+    generate_moves(game, moves);
+
+    if (moves->count == moves->edgeCount) {
+        return evaluate(game, player);
+    }
+
+    order_moves(search, moves, order, player);
+    if (search->stopped) {
+        return 0;
+    }
+    promote_move(order, moves->count, hit.move);
+
+    for (i = 0; i < moves->count; i++) {
+        int value;
+
+        apply_move(game, order[i].move / columns, order[i].move % columns,
+		player, &record);
+        value = -solve(search, -beta, -alpha, other_player(player), ply + 1);
+        undo_move(game, &record);
+
+        if (search->stopped) {
+            return 0;
+        }
+
+        if (value > best) {
+            best = value;
+            bestMove = order[i].move;
+        }
+        if (value > alpha) {
+            alpha = value;
+        }
+        if (alpha >= beta) {
+            break;
+        }
+    }
+
+    if (best <= originalAlpha) {
+        bound = BOUND_UPPER;
+    } else if (best >= beta) {
+        bound = BOUND_LOWER;
+    } else {
+        bound = BOUND_EXACT;
+    }
+    store_table(search->table, key, SOLVED_DEPTH, bound, best, bestMove);
+
+    return best;
+}
+
+/* Set up a search of the given game for the engine, starting iterative
+ * deepening at the given depth and taking its memory from the given arena
+ * The search stops once finished is set, as well as when time runs out
+ * */
+void init_search(Search* search, GameState* game, Engine* engine,
+	bool* finished, int startDepth, Arena* arena) {
+    memset(search, 0, sizeof(Search));
+    search->game = game;
+    search->table = &engine->table;
+    search->arena = arena;
+    search->finished = finished;
+    search->startDepth = startDepth;
+    if (engine->options->searchDepth > 0) {
+        search->deadline = DBL_MAX;
+    } else {
+        search->deadline = now_ms() + engine->options->thinkTime;
+    }
+}
+
+/* Run a helper thread's search
+ * */
+void* run_helper(void* helper) {
+    SearchThread* thread = (SearchThread*)helper;
+
+    iterate_search(&thread->search, thread->player, thread->maxDepth);
+    return NULL;
+}
+
+/* Start pondering the reply of the given player, of the given type, to the
+ * move their opponent is about to choose, in the engine's last arena
+ * Only a type 2 player searching for a think time ponders, as a fixed
+ * depth search must not depend on timing
+ * */
+void start_ponder(Ponder* ponder, GameState* game, char player, char type,
+	Engine* engine) {
+    Options* options = engine->options;
+    Arena* arena = &engine->arenas[options->threads];
+
+    ponder->thread.started = false;
+    if (type != '2' || options->searchDepth > 0) {
+        return;
+    }
+
+    if (engine->table.entries == NULL) {
+        init_table(&engine->table, options->tableSize);
+    }
+    engine->table.age++;
+
+    copy_game(&ponder->thread.game, game, arena);
+    init_search(&ponder->thread.search, &ponder->thread.game, engine,
+	    &ponder->finished, 1, arena);
+    ponder->thread.search.deadline = DBL_MAX;
+    ponder->thread.player = player;
+    ponder->finished = false;
+    ponder->predicted = false;
+    ponder->start = now_ms();
+    ponder->engine = engine;
+
+    ponder->thread.started = pthread_create(&ponder->thread.thread, NULL,
+	    run_ponder, ponder) == 0;
+    if (!ponder->thread.started) {
+        reset_arena(arena);
+    }
+}
+
+/* Run a ponder thread: predict the opponent's move and search the reply to
+ * it, unless after it the game would be over or the reply would come from
+ * the opening book or an endgame solve
+ * */
+void* run_ponder(void* ponder) {
+    Ponder* shared = (Ponder*)ponder;
+    Search* search = &shared->thread.search;
+    GameState* game = &shared->thread.game;
+    Options* options = shared->engine->options;
+    char player = shared->thread.player, opponent = other_player(player);
+    int columns = game->positions->columns, predicted = -1, bookMove, i;
+    MoveRecord record;
+    MoveList* moves;
+    TableHit hit;
+
+    prepare_ply(search, 0);
+    moves = &search->plyMoves[0];
+    generate_moves(game, moves);
+    if (moves->count == 0) {
+        return NULL;
+    }
+
+    if (probe_table(search->table, position_key(game, opponent), &hit)) {
+        for (i = 0; i < moves->count; i++) {
+            if (moves->moves[i] == hit.move) {
+                predicted = hit.move;
+            }
+        }
+    }
+    if (predicted == -1) {
+        order_moves(search, moves, search->plyOrder[0], opponent);
+        if (search->stopped) {
+            return NULL;
+        }
+        predicted = search->plyOrder[0][0].move;
+    }
+
+    apply_move(game, predicted / columns, predicted % columns, opponent,
+	    &record);
+    if (game_over(game->positions) ||
+	    probe_book(&options->book, game, player, &bookMove) ||
+	    (options->solveEmpties > 0 &&
+	    game->positions->interiorEmpties <= options->solveEmpties)) {
+        return NULL;
+    }
+
+    shared->thread.maxDepth = count_empty(game->positions);
+    if (shared->thread.maxDepth > MAX_SEARCH_DEPTH) {
+        shared->thread.maxDepth = MAX_SEARCH_DEPTH;
+    }
+    shared->predictedHash = game->hash;
+    __atomic_store_n(&shared->predicted, true, __ATOMIC_RELEASE);
+
+    iterate_search(search, player, shared->thread.maxDepth);
+    return NULL;
+}
+
+/* Stop pondering once the opponent has moved in the game
+ * If they played the predicted move the search carries on until the think
+ * time since pondering started has passed (or it searches as deep as it
+ * can), and the engine is left to play its move
+ * */
+void finish_ponder(Ponder* ponder, GameState* game, Engine* engine) {
+    double deadline = ponder->start + engine->options->thinkTime;
+    bool hit;
+
+    if (!ponder->thread.started) {
+        return;
+    }
+
+    hit = __atomic_load_n(&ponder->predicted, __ATOMIC_ACQUIRE) &&
+	    ponder->predictedHash == game->hash;
+    if (hit) {
+        __atomic_store(&ponder->thread.search.deadline, &deadline,
+		__ATOMIC_RELAXED);
+    } else {
+        __atomic_store_n(&ponder->finished, true, __ATOMIC_RELAXED);
+    }
+    pthread_join(ponder->thread.thread, NULL);
+
+    if (hit) {
+        engine->ponderMove = ponder->thread.search.bestMove;
+    }
+    reset_arena(&engine->arenas[engine->options->threads]);
+}
+
+/* Search the position with iterative deepening up to maxDepth, recording
+ * the best move of the deepest completed iteration (or the best move found
+ * so far if the first iteration could not finish in time) in the search
+ * */
+void iterate_search(Search* search, char player, int maxDepth) {
+    GameState* game = search->game;
+    MoveList* moves;
+    ScoredMove* order;
+    MoveRecord record;
+    int columns = game->positions->columns, depth, i;
+
+    prepare_ply(search, 0);
+    moves = &search->plyMoves[0];
+    order = search->plyOrder[0];
+    generate_moves(game, moves);
+    order_moves(search, moves, order, player);
+    search->bestMove = search->stopped ? moves->moves[0] : order[0].move;
+
+    for (depth = search->startDepth; depth <= maxDepth && !search->stopped;
+	    depth++) {
+        int alpha = -INT_MAX, iterationBest = -1;
+
+        for (i = 0; i < moves->count; i++) {
+            int value;
+
+            apply_move(game, order[i].move / columns, order[i].move % columns,
+		    player, &record);
+            value = -negamax(search, depth - 1, -INT_MAX, -alpha,
+		    other_player(player), 1);
+            undo_move(game, &record);
+
+            if (search->stopped) {
+                break;
+            }
+
+            order[i].key = value;
+            if (value > alpha) {
+                alpha = value;
+                iterationBest = order[i].move;
+            }
+        }
+
+        /* Every move tried in the first iteration was fully searched */
+        if (iterationBest != -1 && (!search->stopped ||
+		depth == search->startDepth)) {
+            search->bestMove = iterationBest;
+        }
+        if (!search->stopped) {
+            search->completedDepth = depth;
+        }
+
+        /* Try the best moves of this iteration first in the next one */
+        if (!search->stopped) {
+            qsort(order, moves->count, sizeof(ScoredMove),
+		    compare_scored_moves);
+        }
+    }
+}
+
+/* Search the current position to the given depth with alpha-beta pruning
+ * Positions already searched deeply enough are taken from the transposition
+ * table, and the best move stored for a position is tried first
+ * Return the value of the position for the given player, the difference
+ * between their score and their opponent's at the end of the best line
+ * */
+int negamax(Search* search, int depth, int alpha, int beta, char player,
+	int ply) {
+    GameState* game = search->game;
+    MoveList* moves;
+    ScoredMove* order;
+    MoveRecord record;
+    TableHit hit;
+    uint64_t key;
+    int columns = game->positions->columns, best = -INT_MAX, i;
+    int originalAlpha = alpha, bestMove = -1, bound;
+
+    if (out_of_time(search)) {
+        return 0;
+    }
+
+    if (depth == 0) {
+        return evaluate(game, player);
+    }
+
+    key = position_key(game, player);
+    hit.move = -1;
+    if (probe_table(search->table, key, &hit) && hit.depth >= depth &&
+	    (hit.bound == BOUND_EXACT ||
+	    (hit.bound == BOUND_LOWER && hit.value >= beta) ||
+	    (hit.bound == BOUND_UPPER && hit.value <= alpha))) {
+        return hit.value;
+    }
+
+    prepare_ply(search, ply);
+    moves = &search->plyMoves[ply];
+    order = search->plyOrder[ply];
+    generate_moves(game, moves);
+
+    /* The game is over once there are no interior positions to fill */
+    if (moves->count == moves->edgeCount) {
+        return evaluate(game, player);
+    }
+
+    if (depth > 1) {
+        order_moves(search, moves, order, player);
+        if (search->stopped) {
+            return 0;
+        }
+    } else {
+        for (i = 0; i < moves->count; i++) {
+            order[i].move = moves->moves[i];
+        }
+    }
+    promote_move(order, moves->count, hit.move);
+
+    for (i = 0; i < moves->count; i++) {
+        int value;
+
+        apply_move(game, order[i].move / columns, order[i].move % columns,
+		player, &record);
+        value = -negamax(search, depth - 1, -beta, -alpha,
+		other_player(player), ply + 1);
+        undo_move(game, &record);
+
+        if (search->stopped) {
+            return 0;
+        }
+
+        if (value > best) {
+            best = value;
+            bestMove = order[i].move;
+        }
+        if (value > alpha) {
+            alpha = value;
+        }
+        if (alpha >= beta) {
+            break;
+        }
+    }
+
+    if (best <= originalAlpha) {
+        bound = BOUND_UPPER;
+    } else if (best >= beta) {
+        bound = BOUND_LOWER;
+    } else {
+        bound = BOUND_EXACT;
+    }
+    store_table(search->table, key, depth, bound, best, bestMove);
+
+    return best;
+}
+
+/* Move the given move to the front of the order, keeping the rest of the
+ * moves in the same order; nothing changes if the move is not in the order
+ * */
+void promote_move(ScoredMove* order, int count, int move) {
+    int i;
+
+    for (i = 0; i < count; i++) {
+        if (order[i].move == move) {
+            ScoredMove promoted = order[i];
+
+            memmove(order + 1, order, sizeof(ScoredMove) * i);
+            order[0] = promoted;
+            return;
+        }
+    }
+}
+
+/* Count a node visited by the search, checking the clock (and whether
+ * another thread has finished the search) every CLOCK_CHECK_NODES nodes,
+ * and stopping once the search reaches its node limit
+ * Return true if the search has run out of time and false otherwise
+ * */
+bool out_of_time(Search* search) {
+    search->nodes++;
+    STATS_ADD(nodes, 1);
+    if (search->nodeLimit > 0 && search->nodes >= search->nodeLimit) {
+        search->stopped = true;
+    }
+    if (search->nodes % CLOCK_CHECK_NODES == 0) {
+        double deadline;
+
+        __atomic_load(&search->deadline, &deadline, __ATOMIC_RELAXED);
+        if (now_ms() >= deadline || __atomic_load_n(search->finished,
+		__ATOMIC_RELAXED)) {
+            search->stopped = true;
+        }
+    }
+
+    return search->stopped;
+}
+
+/* Make sure the move list and ordering buffer for the given ply exist
+ * */
+void prepare_ply(Search* search, int ply) {
+    if (search->plyOrder[ply] == NULL) {
+        init_move_list(&search->plyMoves[ply], search->game->positions,
+		search->arena);
+        search->plyOrder[ply] = (ScoredMove*)arena_alloc(search->arena,
+		sizeof(ScoredMove) * search->plyMoves[ply].capacity);
+    }
+}
+
+/* Order the given moves best first for the given player, judging each move
+ * by the value of the position straight after it
+ * Each position judged counts as a node, so ordering stops part way through
+ * if the search runs out of time
+ * */
+void order_moves(Search* search, MoveList* moves, ScoredMove* order,
+	char player) {
+    GameState* game = search->game;
+    MoveRecord record;
+    int columns = game->positions->columns, i;
+
+    for (i = 0; i < moves->count; i++) {
+        if (out_of_time(search)) {
+            return;
+        }
+
+        order[i].move = moves->moves[i];
+        apply_move(game, order[i].move / columns, order[i].move % columns,
+		player, &record);
+        order[i].key = evaluate(game, player);
+        undo_move(game, &record);
+    }
+
+    qsort(order, moves->count, sizeof(ScoredMove), compare_scored_moves);
+}
+
+/* Compare two scored moves so that higher keys sort first, breaking ties
+ * by the position of the move so that the order is always the same
+ * */
+int compare_scored_moves(const void* first, const void* second) {
+    const ScoredMove* a = (const ScoredMove*)first;
+    const ScoredMove* b = (const ScoredMove*)second;
+
+    if (a->key != b->key) {
+        return a->key > b->key ? -1 : 1;
+    }
+    return a->move - b->move;
+}
+
+/* Return the value of the current position for the given player
+ * */
+int evaluate(GameState* game, char player) {
+    if (player == 'O') {
+        return game->oScore - game->xScore;
+    } else {
+        return game->xScore - game->oScore;
+    }
+}
+
+/* Return the player who moves after the given player
+ * */
+char other_player(char player) {
+    return player == 'O' ? 'X' : 'O';
+}
+
+/* Count the empty positions on the board
+ * Each move fills one, so this bounds the number of moves left in the game
+ * */
+int count_empty(Positions* positions) {
+    int r, empty = 0;
+
+    for (r = 0; r < positions->rows; r++) {
+        empty += positions->rowEmpties[r];
+    }
+
+    return empty;
+}
+
+/* Return the time on a monotonic clock in milliseconds
+ * */
+double now_ms(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000.0 + now.tv_nsec / 1000000.0;
+}
+
+/* Choose a move for the given player with Monte Carlo tree search, using
+ * UCT to pick the moves to explore and random playouts to the end of the
+ * game to judge them
+ * Each thread grows its own tree from the current position (root
+ * parallelism), sharing the node memory budget, and the root move visited
+ * most across all of the trees is played
+ * The number of playouts run per second is reported on stderr, unless the
+ * engine is told not to
+ * Return the index of the position to be played
+ * */
+int mcts_move(GameState* game, char player, Engine* engine) {
+    Options* options = engine->options;
+    int threads = options->threads, nodeLimit, i, j, bestMove;
+    long bestVisits = -1, playouts = 0;
+    size_t bytes = (size_t)options->tableSize << 20;
+    double start = now_ms(), elapsed;
+    PlayoutTree* trees;
+
+    nodeLimit = bytes / sizeof(TreeNode) / threads > INT_MAX ? INT_MAX :
+	    (int)(bytes / sizeof(TreeNode) / threads);
+    trees = (PlayoutTree*)arena_alloc(&engine->arenas[0],
+	    sizeof(PlayoutTree) * threads);
+    for (i = 0; i < threads; i++) {
+        init_playout_tree(&trees[i], game, player, options, nodeLimit,
+		engine->seed * threads + i, &engine->arenas[0]);
+        trees[i].deadline = start + options->thinkTime;
+    }
+    bestMove = trees[0].moves.moves[0];
+    for (i = 1; i < threads; i++) {
+        trees[i].started = pthread_create(&trees[i].thread, NULL,
+		run_playouts, &trees[i]) == 0;
+    }
+
+    run_playouts(&trees[0]);
+    for (i = 1; i < threads; i++) {
+        if (trees[i].started) {
+            pthread_join(trees[i].thread, NULL);
+        }
+    }
+
+    /* Every tree expanded the same root moves in the same order */
+    for (j = 0; j < trees[0].nodes[0].childCount; j++) {
+        long visits = 0;
+
+        for (i = 0; i < threads; i++) {
+            visits += trees[i].nodes[trees[i].nodes[0].firstChild + j].visits;
+        }
+        if (visits > bestVisits) {
+            bestVisits = visits;
+            bestMove = trees[0].nodes[trees[0].nodes[0].firstChild + j].move;
+        }
+    }
+
+    for (i = 0; i < threads; i++) {
+        playouts += trees[i].playouts;
+    }
+
+    elapsed = now_ms() - start;
+    engine->playouts += playouts;
+    engine->playoutTime += elapsed;
+    if (engine->reportMoves) {
+        fprintf(stderr, "Player %c ran %ld playouts in %.0f ms "
+		"(%.0f playouts/s)\n", player, playouts, elapsed, elapsed > 0 ?
+		playouts * 1000.0 / elapsed : 0.0);
+    }
+    return bestMove;
+}
+
+/* Set up a Monte Carlo tree for the given player on a copy of the game,
+ * with its root already expanded, all allocated from the given arena
+ * The seed picks this tree's sequence of random moves, which is otherwise
+ * fixed by the position so that fixed playout searches are reproducible
+ * */
+void init_playout_tree(PlayoutTree* tree, GameState* game, char player,
+	Options* options, int nodeLimit, int seed, Arena* arena) {
+    int moves = count_empty(game->positions) + 1;
+
+    copy_game(&tree->game, game, arena);
+    tree->player = player;
+    tree->started = false;
+    tree->nodeLimit = nodeLimit;
+    tree->nodes = (TreeNode*)arena_alloc(arena, sizeof(TreeNode) * nodeLimit);
+    tree->path = (int*)arena_alloc(arena, sizeof(int) * (moves + 1));
+    tree->records = (MoveRecord*)arena_alloc(arena,
+	    sizeof(MoveRecord) * moves);
+    init_move_list(&tree->moves, game->positions, arena);
+    tree->random = position_key(game, player) ^ zobrist_key(seed, '.');
+    tree->playoutLimit = options->playouts;
+    tree->playouts = 0;
+
+    tree->nodeCount = 1;
+    tree->nodes[0].move = -1;
+    tree->nodes[0].firstChild = -1;
+    tree->nodes[0].childCount = 0;
+    tree->nodes[0].visits = 0;
+    tree->nodes[0].wins = 0;
+    expand_node(tree, 0);
+}
+
+/* Run playouts on a Monte Carlo tree until its playout limit is reached or
+ * it runs out of time
+ * */
+void* run_playouts(void* playoutTree) {
+    PlayoutTree* tree = (PlayoutTree*)playoutTree;
+
+    while (tree->playoutLimit > 0 ? tree->playouts < tree->playoutLimit :
+	    now_ms() < tree->deadline) {
+        run_playout(tree);
+        tree->playouts++;
+    }
+
+    return NULL;
+}
+
+/* Run one playout: walk down the tree choosing moves with UCT, expand the
+ * leaf reached, play random moves from it to the end of the game, then undo
+ * every move and credit the result to each node on the path
+ * */
+void run_playout(PlayoutTree* tree) {
+    GameState* game = &tree->game;
+    MoveList* moves = &tree->moves;
+    int columns = game->positions->columns, node = 0, depth = 0, i;
+    char player = tree->player, winner;
+
+    STATS_ADD(nodes, 1);
+    tree->path[0] = 0;
+    while (tree->nodes[node].firstChild != -1 ||
+	    (tree->nodes[node].visits > 0 && expand_node(tree, node))) {
+        if (tree->nodes[node].childCount == 0) {
+            break;
+        }
+
+        node = select_child(tree, node);
+        apply_move(game, tree->nodes[node].move / columns,
+		tree->nodes[node].move % columns, player,
+		&tree->records[depth]);
+        tree->path[++depth] = node;
+        player = other_player(player);
+    }
+
+    /* Play random moves until no interior positions are left to fill */
+    for (i = depth; ; i++) {
+        int move;
+
+        generate_moves(game, moves);
+        if (moves->count == moves->edgeCount) {
+            break;
+        }
+
+        move = moves->moves[((next_random(&tree->random) >> 32) *
+		moves->count) >> 32];
+        apply_move(game, move / columns, move % columns, player,
+		&tree->records[i]);
+        player = other_player(player);
+    }
+
+    if (game->oScore > game->xScore) {
+        winner = 'O';
+    } else if (game->xScore > game->oScore) {
+        winner = 'X';
+    } else {
+        winner = '.';
+    }
+
+    while (i > 0) {
+        undo_move(game, &tree->records[--i]);
+    }
+
+    /* The node at depth d was reached by a move of the root player when d
+     * is odd */
+    player = tree->player;
+    for (i = 0; i <= depth; i++) {
+        TreeNode* pathNode = &tree->nodes[tree->path[i]];
+        char mover = i % 2 == 1 ? player : other_player(player);
+
+        pathNode->visits++;
+        if (winner == mover) {
+            pathNode->wins += 1;
+        } else if (winner == '.') {
+            pathNode->wins += 0.5;
+        }
+    }
+}
+
+/* Give the node a child for each legal move in the position it represents,
+ * if the game is not over there
+ * Return false if there is no room left in the node pool, or true otherwise
+ * */
+bool expand_node(PlayoutTree* tree, int node) {
+    MoveList* moves = &tree->moves;
+    int i;
+
+    generate_moves(&tree->game, moves);
+    if (moves->count == moves->edgeCount) {
+        tree->nodes[node].firstChild = tree->nodeCount;
+        tree->nodes[node].childCount = 0;
+        return true;
+    }
+
+    if (moves->count > tree->nodeLimit - tree->nodeCount) {
+        return false;
+    }
+
+    tree->nodes[node].firstChild = tree->nodeCount;
+    tree->nodes[node].childCount = moves->count;
+    for (i = 0; i < moves->count; i++) {
+        TreeNode* child = &tree->nodes[tree->nodeCount++];
+
+        child->move = moves->moves[i];
+        child->firstChild = -1;
+        child->childCount = 0;
+        child->visits = 0;
+        child->wins = 0;
+    }
+
+    return true;
+}
+
+/* Choose the child of an expanded node to explore with UCT, taking the
+ * first unvisited child if there is one
+ * Return the index of the chosen child in the node pool
+ * */
+int select_child(PlayoutTree* tree, int node) {
+    TreeNode* parent = &tree->nodes[node];
+    double logVisits = log(parent->visits), bestValue = -1;
+    int i, best = parent->firstChild;
+
+    for (i = parent->firstChild; i < parent->firstChild + parent->childCount;
+	    i++) {
+        TreeNode* child = &tree->nodes[i];
+        double value;
+
+        if (child->visits == 0) {
+            return i;
+        }
+
+        value = child->wins / child->visits + EXPLORATION *
+		sqrt(logVisits / child->visits);
+        if (value > bestValue) {
+            bestValue = value;
+            best = i;
+        }
+    }
+
+    return best;
+}
+
+/* Advance an xorshift64* random number generator
+ * Return the next random number
+ * */
+uint64_t next_random(uint64_t* state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545f4914f6cdd1dULL;
+}
+
+/* Carry out a move for player O when they are a human player
+ * Their input is read into a line from the given arena, grown to fit
+ * */
+void human_o_move(BoardText* text, GameState* game, char* currentPlayer,
+	Arena* arena) {
+    Positions* positions = game->positions;
+    MoveRecord move;
+    int chosenRow = 0, chosenColumn = 0;
+    size_t capacity = LINE_LENGTH;
+    char* buffer = (char*)arena_alloc(arena, capacity);
+
+    while (!valid_position(chosenRow, chosenColumn, positions)) {
+        printf("%c:(R C)> ", *currentPlayer);
+
+        int c = fgetc(stdin);
+        size_t i = 1;
+        if (c == EOF) {
+            fprintf(stderr, "End of file\n");
+            exit(5);
+        }
+
+        buffer[0] = c;
+        while (c = fgetc(stdin), c != '\n' && c != EOF) {
+            if (i + 1 == capacity) {
+                buffer = (char*)arena_grow(arena, buffer, capacity,
+			capacity * 2);
+                capacity *= 2;
+            }
+            buffer[i] = c;
+            i++;
+        }
+        buffer[i] = '\0';
+
+        size_t len = strlen(buffer);
+
+        if (buffer[0] == 's' && len > 1) {
+            save_game(text, positions, buffer + 1, currentPlayer);
+        } else {
+            sscanf(buffer, "%d %d", &chosenRow, &chosenColumn);
+        }
+    }
+
+    apply_move(game, chosenRow, chosenColumn, *currentPlayer, &move);
+    *currentPlayer = 'X';
+}
+
+/* Carry out a move for player X when they are a human player
+ * Their input is read into a line from the given arena, grown to fit
+ * */
+void human_x_move(BoardText* text, GameState* game, char* currentPlayer,
+	Arena* arena) {
+    Positions* positions = game->positions;
+    MoveRecord move;
+    int chosenRow = 0, chosenColumn = 0;
+    size_t capacity = LINE_LENGTH;
+    char* buffer = (char*)arena_alloc(arena, capacity);
+
+    while (!valid_position(chosenRow, chosenColumn, positions)) {
+        printf("%c:(R C)> ", *currentPlayer);
+
+        int c = fgetc(stdin);
+        size_t i = 1;
+        if (c == EOF) {
+            fprintf(stderr, "End of file\n");
+            exit(5);
+        }
+
+        buffer[0] = c;
+        while (c = fgetc(stdin), c != '\n' && c != EOF) {
+            if (i + 1 == capacity) {
+                buffer = (char*)arena_grow(arena, buffer, capacity,
+			capacity * 2);
+                capacity *= 2;
+            }
+            buffer[i] = c;
+            i++;
+        }
+        buffer[i] = '\0';
+
+        size_t len = strlen(buffer);
+
+        if (buffer[0] == 's' && len > 1) {
+            save_game(text, positions, buffer + 1, currentPlayer);
+        } else {
+            sscanf(buffer, "%d %d", &chosenRow, &chosenColumn);
+        }
+    }
+
+    apply_move(game, chosenRow, chosenColumn, *currentPlayer, &move);
+    *currentPlayer = 'O';
+}
+
+/* Ensure that the given row and column gives a valid position
+ * Return true if the position is on the interior and empty or on the edge
+ * and produces a valid push
+ * Return false otherwise
+ * */
+bool valid_position(int chosenRow, int chosenColumn, Positions* positions) {
+    int rows = positions->rows, columns = positions->columns;
+    bool valid;
+    STATS_START;
+
+    if (chosenRow < 0 || chosenRow > rows - 1) {
+        valid = false;
+    } else if (chosenColumn < 0 || chosenColumn > columns - 1) {
+        valid = false;
+    } else if (chosenRow == 0 && chosenColumn == 0) {
+        valid = false;
+    } else if (chosenRow == 0 && chosenColumn == columns - 1) {
+        valid = false;
+    } else if (chosenRow == rows - 1 && chosenColumn == 0) {
+        valid = false;
+    } else if (chosenRow == rows - 1 && chosenColumn == columns - 1) {
+        valid = false;
+    } else if (!test_position(positions, positions->emptyPlane, chosenRow,
+	    chosenColumn)) {
+        valid = false;
+    } else if (outer_position(chosenRow, chosenColumn, rows, columns) &&
+	    !valid_push(chosenRow, chosenColumn, positions)) {
+        valid = false;
+    } else {
+        valid = true;
+    }
+
+    STATS_STOP(STAT_VALID_POSITION);
+    return valid;
+}
+
+/* Check if the given row and column give a position on the edge of the board
+ * Return true if the position is on the edge and false otherwise
+ * */
+bool outer_position(int chosenRow, int chosenColumn, int rows, int columns) {
+    if (chosenRow == 0 || chosenRow == rows - 1 || chosenColumn == 0 ||
+	    chosenColumn == columns - 1) {
+        return true;
+    } else {
+        return false;
+    }
+}
+
+/* Return a pointer to the words holding the given row of a plane
+ * */
+uint64_t* plane_row(Positions* positions, uint64_t* plane, int row) {
+    return plane + (size_t)row * positions->rowWords;
+}
+
+/* Return a mask of the bits in the given word of a row which lie between
+ * the first and last columns (inclusive)
+ * */
+uint64_t column_mask(int word, int firstColumn, int lastColumn) {
+    int low = word * PLANE_BITS, high = low + PLANE_BITS - 1;
+
+    if (firstColumn > low) {
+        low = firstColumn;
+    }
+    if (lastColumn < high) {
+        high = lastColumn;
+    }
+    if (low > high) {
+        return 0;
+    }
+
+    return (~(uint64_t)0 >> (PLANE_BITS - 1 - (high - low))) <<
+	    (low - word * PLANE_BITS);
+}
+
+/* Return true if the position at the given row and column is set in the
+ * given plane and false otherwise
+ * */
+bool test_position(Positions* positions, uint64_t* plane, int row,
+	int column) {
+    return (plane_row(positions, plane, row)[column / PLANE_BITS] >>
+	    (column % PLANE_BITS)) & 1;
+}
+
+/* Set or clear the position at the given row and column in the given plane
+ * */
+void set_position(Positions* positions, uint64_t* plane, int row, int column,
+	bool value) {
+    uint64_t* word = plane_row(positions, plane, row) + column / PLANE_BITS;
+    uint64_t bit = (uint64_t)1 << (column % PLANE_BITS);
+
+    if (value) {
+        *word |= bit;
+    } else {
+        *word &= ~bit;
+    }
+}
+
+/* Return the stone at the given row and column
+ * Blank positions are returned as a space
+ * */
+char get_stone(Positions* positions, int row, int column) {
+    if (test_position(positions, positions->oPlane, row, column)) {
+        return 'O';
+    } else if (test_position(positions, positions->xPlane, row, column)) {
+        return 'X';
+    } else if (test_position(positions, positions->emptyPlane, row, column)) {
+        return '.';
+    } else {
+        return ' ';
+    }
+}
+
+/* Place the given stone at the given row and column
+ * Anything other than an O, X or empty stone leaves the position blank
+ * */
+void set_stone(Positions* positions, int row, int column, char stone) {
+    set_position(positions, positions->oPlane, row, column, stone == 'O');
+    set_position(positions, positions->xPlane, row, column, stone == 'X');
+    set_empty(positions, row, column, stone == '.');
+}
+
+/* Mark the position at the given row and column as empty or not, keeping
+ * the transposed empty plane, the empty counts and the nearest empty
+ * positions of its row and column up to date
+ * */
+void set_empty(Positions* positions, int row, int column, bool empty) {
+    int rows = positions->rows, columns = positions->columns;
+    uint64_t* word = positions->emptyColumnPlane + (size_t)column *
+	    positions->columnWords + row / PLANE_BITS;
+    uint64_t bit = (uint64_t)1 << (row % PLANE_BITS);
+
+    if (test_position(positions, positions->emptyPlane, row, column) ==
+	    empty) {
+        return;
+    }
+    set_position(positions, positions->emptyPlane, row, column, empty);
+    if (row > 0 && row < rows - 1 && column > 0 && column < columns - 1) {
+        positions->interiorEmpties += empty ? 1 : -1;
+    }
+
+    if (empty) {
+        *word |= bit;
+        positions->rowEmpties[row]++;
+        positions->columnEmpties[column]++;
+
+        if (column > 0 && column < positions->rowFirstEmpty[row]) {
+            positions->rowFirstEmpty[row] = column;
+        }
+        if (column < columns - 1 && column > positions->rowLastEmpty[row]) {
+            positions->rowLastEmpty[row] = column;
+        }
+        if (row > 0 && row < positions->columnFirstEmpty[column]) {
+            positions->columnFirstEmpty[column] = row;
+        }
+        if (row < rows - 1 && row > positions->columnLastEmpty[column]) {
+            positions->columnLastEmpty[column] = row;
+        }
+    } else {
+        *word &= ~bit;
+        positions->rowEmpties[row]--;
+        positions->columnEmpties[column]--;
+
+        if (column == positions->rowFirstEmpty[row]) {
+            int next = first_empty_in_row(positions, row, column + 1,
+		    columns - 1);
+            positions->rowFirstEmpty[row] = next == -1 ? columns : next;
+        }
+        if (column == positions->rowLastEmpty[row]) {
+            positions->rowLastEmpty[row] = last_empty_in_row(positions, row, 0,
+		    column - 1);
+        }
+        if (row == positions->columnFirstEmpty[column]) {
+            int next = first_empty_in_column(positions, column, row + 1,
+		    rows - 1);
+            positions->columnFirstEmpty[column] = next == -1 ? rows : next;
+        }
+        if (row == positions->columnLastEmpty[column]) {
+            positions->columnLastEmpty[column] = last_empty_in_column(
+		    positions, column, 0, row - 1);
+        }
+    }
+}
+
+/* Find the lowest set bit of a multi-word line between the first and last
+ * bits (inclusive)
+ * Return the index of the bit, or -1 if there is none
+ * */
+int first_set_bit(uint64_t* words, int first, int last) {
+    int word;
+
+    if (first > last) {
+        return -1;
+    }
+
+    for (word = first / PLANE_BITS; word <= last / PLANE_BITS; word++) {
+        uint64_t bits = words[word] & column_mask(word, first, last);
+
+        if (bits) {
+            return word * PLANE_BITS + __builtin_ctzll(bits);
+        }
+    }
+
+    return -1;
+}
+
+/* Find the highest set bit of a multi-word line between the first and last
+ * bits (inclusive)
+ * Return the index of the bit, or -1 if there is none
+ * */
+int last_set_bit(uint64_t* words, int first, int last) {
+    int word;
+
+    if (first > last) {
+        return -1;
+    }
+
+    for (word = last / PLANE_BITS; word >= first / PLANE_BITS; word--) {
+        uint64_t bits = words[word] & column_mask(word, first, last);
+
+        if (bits) {
+            return word * PLANE_BITS + PLANE_BITS - 1 - __builtin_clzll(bits);
+        }
+    }
+
+    return -1;
+}
+
+/* Find the first empty position in the given row between the first and last
+ * columns (inclusive)
+ * Return the column of the empty position, or -1 if there is none
+ * */
+int first_empty_in_row(Positions* positions, int row, int firstColumn,
+	int lastColumn) {
+    return first_set_bit(plane_row(positions, positions->emptyPlane, row),
+	    firstColumn, lastColumn);
+}
+
+/* Find the last empty position in the given row between the first and last
+ * columns (inclusive)
+ * Return the column of the empty position, or -1 if there is none
+ * */
+int last_empty_in_row(Positions* positions, int row, int firstColumn,
+	int lastColumn) {
+    return last_set_bit(plane_row(positions, positions->emptyPlane, row),
+	    firstColumn, lastColumn);
+}
+
+/* Find the first empty position in the given column between the first and
+ * last rows (inclusive)
+ * Return the row of the empty position, or -1 if there is none
+ * */
+int first_empty_in_column(Positions* positions, int column, int firstRow,
+	int lastRow) {
+    return first_set_bit(positions->emptyColumnPlane + (size_t)column *
+	    positions->columnWords, firstRow, lastRow);
+}
+
+/* Find the last empty position in the given column between the first and
+ * last rows (inclusive)
+ * Return the row of the empty position, or -1 if there is none
+ * */
+int last_empty_in_column(Positions* positions, int column, int firstRow,
+	int lastRow) {
+    return last_set_bit(positions->emptyColumnPlane + (size_t)column *
+	    positions->columnWords, firstRow, lastRow);
+}
+
+/* Ensure that playing a stone at the position given by the specified row and
+ * column would produce a valid push
+ * A push is valid when there is an empty cell in the direction of the push
+ * or there is a stone to be pushed immediately next to the position
+ * Return true if the push is valid and false otherwise
+ * */
+bool valid_push(int chosenRow, int chosenColumn, Positions* positions) {
+    int rows = positions->rows, columns = positions->columns;
+    bool valid;
+    STATS_START;
 
-/* Represents an individual position on the board */
-typedef struct {
-    int row;
-    int column;
-    int score;
-    char stone;
-} Position;
+    /* The nearest empty position to the edge must be beyond the position
+     * next to the edge, since that position must hold a stone to push */
+    if (chosenRow == 0) {
+        int row = positions->columnFirstEmpty[chosenColumn];
+        valid = row >= 2 && row < rows;
+    } else if (chosenRow == rows - 1) {
+        int row = positions->columnLastEmpty[chosenColumn];
+        valid = row >= 0 && row <= rows - 3;
+    } else if (chosenColumn == 0) {
+        int column = positions->rowFirstEmpty[chosenRow];
+        valid = column >= 2 && column < columns;
+    } else {
+        int column = positions->rowLastEmpty[chosenRow];
+        valid = column >= 0 && column <= columns - 3;
+    }
 
-void check_arguments(char pOType, char pXType, FILE* saveFile);
-void read_savefile(FILE* saveFile, char pOType, char pXType);
-void assign_positions(Position* positions, char** board, int rows, 
-	int columns);
-void check_full_board(int rows, int columns, Position* positions);
-void check_game_setup(int rows, int columns, int numRows, 
-	char** separatedRows);
-void check_board(int rows, int columns, int numRows, char** separatedRows);
-bool correct_corner_position(char** separatedRows, int rows, int columns);
-void update_board(char** board, Position* positions, int rows, int columns);
-void display_board(char** board, int rows, int columns);
-void play_game(char** board, int rows, int columns, Position* positions, 
-	char pOType, char pXType, char* currentPlayer);
-void automated_o_move(int rows, int columns, Position* positions, char pOType, 
-	char* currentPlayer);
-void automated_x_move(int rows, int columns, Position* positions, char pXType, 
-	char* currentPlayer);
-int* type1(Position* positions, int rows, int columns, 
-	char* currentPlayer);
-void human_o_move(char** board, int rows, int columns, Position* positions, 
-	char* currentPlayer);
-void human_x_move(char** board, int rows, int columns, Position* positions, 
-	char* currentPlayer);
-char** check_savefile(char* buffer);
-bool valid_position(int chosenRow, int chosenColumn, int rows, int columns, 
-	Position* positions);
-bool outer_position(int chosenRow, int chosenColumn, int rows, int columns);
-bool valid_push(int chosenRow, int chosenColumn, int rows, int columns, 
-	Position* positions);
-int* get_o_score(Position* positions, int rows, int columns);
-int* get_x_score(Position* positions, int rows, int columns);
-bool decrease_score(Position* positions, int chosenRow, int chosenColumn, 
-	int rows, int columns, char* currentPlayer);
-void push_stones(int chosenRow, int chosenColumn, int rows, int columns, 
-	Position* positions, char* currentPlayer);
-void downward_push(Position* positions, int rows, int columns, 
-	int chosenIndex, char* currentPlayer);
-void left_push(Position* positions, int rows, int columns, int chosenIndex, 
-	char* currentPlayer);
-void right_push(Position* positions, int rows, int columns, int chosenIndex, 
-	char* currentPlayer);
-void upward_push(Position* positions, int rows, int columns, int chosenIndex, 
-	char* currentPlayer);
-bool game_over(Position* positions, int rows, int columns);
-void display_winners(Position* positions, int rows, int columns);
-void save_game(char** board, int rows, int columns, char* fileName, char* 
-	currentPlayer);
+    STATS_STOP(STAT_VALID_PUSH);
+    return valid;
+}
 
-int main(int argc, char** argv) {
-    /* Check the number of arguments */
-    if (argc != 4) {
-        fprintf(stderr, "Usage: push2310 typeO typeX fname\n");
-        exit(1);
+/* Play the given stone at the position given by the specified row and
+ * column, pushing stones if the position is on the edge
+ * The changes made are recorded in the given move so that they can be
+ * undone with undo_move
+ * */
+void apply_move(GameState* game, int chosenRow, int chosenColumn, char stone,
+	MoveRecord* move) {
+    Positions* positions = game->positions;
+
+    move->row = chosenRow;
+    move->column = chosenColumn;
+    move->oScore = game->oScore;
+    move->xScore = game->xScore;
+    move->hash = game->hash;
+
+    if (outer_position(chosenRow, chosenColumn, positions->rows,
+	    positions->columns)) {
+        move->shiftIndex = push_stones(chosenRow, chosenColumn, game, &stone);
+    } else {
+        move->shiftIndex = -1;
+        place_stone(game, chosenRow, chosenColumn, stone);
     }
+}
 
-    char pOType, pXType;
-    pOType = argv[1][0];
-    pXType = argv[2][0];
-    FILE* saveFile = fopen(argv[3], "r");
+/* Undo the given move, which must be the last move applied to the game
+ * A push is undone by shifting the displaced stones back one position
+ * towards the edge and emptying the position they were pushed into
+ * */
+void undo_move(GameState* game, MoveRecord* move) {
+    Positions* positions = game->positions;
+    int row = move->row, column = move->column, shift = move->shiftIndex, i;
 
-    check_arguments(pOType, pXType, saveFile);
-    
-    read_savefile(saveFile, pOType, pXType);
+    if (shift == -1) {
+        set_stone(positions, row, column, '.');
+    } else if (column == 0) {
+        shift_row_down(plane_row(positions, positions->oPlane, row),
+		positions->rowWords, 2, shift);
+        shift_row_down(plane_row(positions, positions->xPlane, row),
+		positions->rowWords, 2, shift);
+        set_stone(positions, row, shift, '.');
+    } else if (column == positions->columns - 1) {
+        shift_row_up(plane_row(positions, positions->oPlane, row), shift,
+		positions->columns - 3);
+        shift_row_up(plane_row(positions, positions->xPlane, row), shift,
+		positions->columns - 3);
+        set_stone(positions, row, shift, '.');
+    } else if (row == 0) {
+        for (i = 1; i < shift; i++) {
+            move_column_stone(positions, column, i + 1, i);
+        }
+        set_stone(positions, shift, column, '.');
+    } else {
+        for (i = positions->rows - 2; i > shift; i--) {
+            move_column_stone(positions, column, i - 1, i);
+        }
+        set_stone(positions, shift, column, '.');
+    }
 
-    return 0;
+    game->oScore = move->oScore;
+    game->xScore = move->xScore;
+    game->hash = move->hash;
 }
 
-/* Ensures that the arguments given to the program
- * Will exit if player types are invalid or if there was an error
- * opening the specified save file */
-void check_arguments(char pOType, char pXType, FILE* saveFile) {
-    /* Check player O type */
-    if (pOType != '0' && pOType != '1' && pOType != 'H') {
-        fprintf(stderr, "Invalid player type\n");
-        exit(2);
-    }
+/* If a push from the position given by the specified row and column is valid,
+ * push the stones in the necessary direction
+ * Return the row or column of the position the stones were pushed into
+ * */
+int push_stones(int chosenRow, int chosenColumn, GameState* game,
+	char* currentPlayer) {
+    int shift;
+    STATS_START;
 
-    /* Check player X type */
-    if (pXType != '0' && pXType != '1' && pXType != 'H') {
-        fprintf(stderr, "Invalid player type\n");
-        exit(2);
+    if (chosenColumn == 0) {
+        shift = right_push(game, chosenRow, currentPlayer);
+    } else if (chosenColumn == game->positions->columns - 1) {
+        shift = left_push(game, chosenRow, currentPlayer);
+    } else if (chosenRow == 0) {
+        shift = downward_push(game, chosenColumn, currentPlayer);
+    } else {
+        shift = upward_push(game, chosenColumn, currentPlayer);
     }
 
-    if (saveFile == 0) {
-        fprintf(stderr, "No file to load from\n");
-        exit(3);
+    STATS_STOP(STAT_PUSH_STONES);
+    return shift;
+}
+
+/* Move the bits of a row between the first and last columns (inclusive) up
+ * by one column, leaving the bit in the first column unchanged
+ * */
+void shift_row_up(uint64_t* row, int firstColumn, int lastColumn) {
+    int word;
+
+    for (word = (lastColumn + 1) / PLANE_BITS; word >= firstColumn /
+	    PLANE_BITS; word--) {
+        uint64_t mask = column_mask(word, firstColumn + 1, lastColumn + 1);
+        uint64_t shifted = row[word] << 1;
+
+        if (word > 0) {
+            shifted |= row[word - 1] >> (PLANE_BITS - 1);
+        }
+        row[word] = (row[word] & ~mask) | (shifted & mask);
     }
 }
 
-/* Read the board into an array of positions, each of which has
- * a row, column, score and stone
- * Return the array of positions
+/* Move the bits of a row between the first and last columns (inclusive) down
+ * by one column, leaving the bit in the last column unchanged
  * */
-Position* initialise_positions(int rows, int columns, char** board) {
-    Position* positions = malloc(sizeof(Position) * rows * columns);
-    int j = 0, r, c;
+void shift_row_down(uint64_t* row, int rowWords, int firstColumn,
+	int lastColumn) {
+    int word;
 
-    for (r = 0; r < rows; r++) {
-        for (c = 0; c < columns * 2; c += 2) {
-            Position position;
-            position.row = r;
-            position.column = c / 2;
-            
-            if (board[r][c] == ' ') {
-                position.score = 0;
-            } else {
-                position.score = board[r][c] - '0';
-            }
+    for (word = (firstColumn - 1) / PLANE_BITS; word <= lastColumn /
+	    PLANE_BITS; word++) {
+        uint64_t mask = column_mask(word, firstColumn - 1, lastColumn - 1);
+        uint64_t shifted = row[word] >> 1;
 
-            position.stone = board[r][c + 1];
-            positions[j] = position;
-            j++;
+        if (word + 1 < rowWords) {
+            shifted |= row[word + 1] << (PLANE_BITS - 1);
         }
+        row[word] = (row[word] & ~mask) | (shifted & mask);
     }
+}
 
-    return positions;
+/* Move the stone in the given column from one row to another
+ * */
+void move_column_stone(Positions* positions, int column, int fromRow,
+	int toRow) {
+    set_position(positions, positions->oPlane, toRow, column,
+	    test_position(positions, positions->oPlane, fromRow, column));
+    set_position(positions, positions->xPlane, toRow, column,
+	    test_position(positions, positions->xPlane, fromRow, column));
 }
 
-/* Read the contents of the savefile and initialise a board
- * made up of the savefile contents for game play*/
-void read_savefile(FILE* saveFile, char pOType, char pXType) {
-    fseek(saveFile, 0, SEEK_END);
-    long length = ftell(saveFile);
-    fseek(saveFile, 0, SEEK_SET);
+/* Push stones when a position in the first row is chosen
+ * Return the row the stones were pushed into
+ * */
+int downward_push(GameState* game, int chosenColumn, char* currentPlayer) {
+    Positions* positions = game->positions;
+    int shiftRow = positions->columnFirstEmpty[chosenColumn], i;
 
-    int i = 0, rows, columns;
-    char* currentPlayer = (char*)malloc(sizeof(char));
-    long offset = 0;
-    char* buffer = (char*)malloc(sizeof(char) * length + 1);
-    
-    if (buffer == NULL) {
-        fprintf(stderr, "Invalid file contents\n");
-        exit(4);
+    if (shiftRow == positions->rows) {
+        shiftRow = positions->rows - 1;
     }
 
-    while (!feof(saveFile) && offset < length) {
-        offset += fread(buffer + offset, sizeof(char), length - offset, 
-		saveFile);
+    account_column(game, chosenColumn, 1, shiftRow, -1);
+
+    for (i = shiftRow; i > 1; i--) {
+        move_column_stone(positions, chosenColumn, i - 1, i);
     }
-    buffer[offset] = '\0';
-    
-    fclose(saveFile);
+    set_empty(positions, shiftRow, chosenColumn, false);
+    set_stone(positions, 1, chosenColumn, *currentPlayer);
+
+    account_column(game, chosenColumn, 1, shiftRow, 1);
+
+    return shiftRow;
+}
+
+/* Push stones when a position in the last column is chosen
+ * Return the column the stones were pushed into
+ * */
+int left_push(GameState* game, int chosenRow, char* currentPlayer) {
+    Positions* positions = game->positions;
+    int lastColumn = positions->columns - 2;
+    int shiftColumn = positions->rowLastEmpty[chosenRow];
 
-    char** separatedRows = check_savefile(buffer);
-    sscanf(separatedRows[0], "%d %d", &rows, &columns);
-    currentPlayer = separatedRows[1];
-    for (i = 2; i < rows + 2; i++) {
-        separatedRows[i][strlen(separatedRows[i])] = '\n';
+    if (shiftColumn == -1) {
+        shiftColumn = 0;
     }
 
-    /* Read the savefile into a 2d array for the board */
-    char** board = (char**)malloc(sizeof(char*) * rows);
-    int r, c;
-    for (r = 0; r < rows; r++) {
-        board[r] = malloc(sizeof(char) * columns * 2 + 1);
+    account_row(game, chosenRow, shiftColumn, lastColumn, -1);
 
-        for (c = 0; c < columns * 2 + 1; c++) {
-            board[r][c] = separatedRows[r + 2][c];
-        }
-    } 
+    shift_row_down(plane_row(positions, positions->oPlane, chosenRow),
+	    positions->rowWords, shiftColumn + 1, lastColumn);
+    shift_row_down(plane_row(positions, positions->xPlane, chosenRow),
+	    positions->rowWords, shiftColumn + 1, lastColumn);
+    set_empty(positions, chosenRow, shiftColumn, false);
+    set_stone(positions, chosenRow, lastColumn, *currentPlayer);
+
+    account_row(game, chosenRow, shiftColumn, lastColumn, 1);
+
+    return shiftColumn;
+}
+
+/* Push stones when a position in the last row is chosen
+ * Return the row the stones were pushed into
+ **/
+int upward_push(GameState* game, int chosenColumn, char* currentPlayer) {
+    Positions* positions = game->positions;
+    int lastRow = positions->rows - 2;
+    int shiftRow = positions->columnLastEmpty[chosenColumn], i;
+
+    if (shiftRow == -1) {
+        shiftRow = 0;
+    }
+
+    account_column(game, chosenColumn, shiftRow, lastRow, -1);
+
+    for (i = shiftRow; i < lastRow; i++) {
+        move_column_stone(positions, chosenColumn, i + 1, i);
+    }
+    set_empty(positions, shiftRow, chosenColumn, false);
+    set_stone(positions, lastRow, chosenColumn, *currentPlayer);
+
+    account_column(game, chosenColumn, shiftRow, lastRow, 1);
 
-    Position* positions = initialise_positions(rows, columns, board);
+    return shiftRow;
+}
+
+/* Push stones when a position in the first column is chosen
+ * Return the column the stones were pushed into
+ * */
+int right_push(GameState* game, int chosenRow, char* currentPlayer) {
+    Positions* positions = game->positions;
+    int lastColumn = positions->columns - 1;
+    int shiftColumn = positions->rowFirstEmpty[chosenRow];
+
+    if (shiftColumn == positions->columns) {
+        shiftColumn = lastColumn;
+    }
+
+    account_row(game, chosenRow, 1, shiftColumn, -1);
+
+    shift_row_up(plane_row(positions, positions->oPlane, chosenRow), 1,
+	    shiftColumn - 1);
+    shift_row_up(plane_row(positions, positions->xPlane, chosenRow), 1,
+	    shiftColumn - 1);
+    set_empty(positions, chosenRow, shiftColumn, false);
+    set_stone(positions, chosenRow, 1, *currentPlayer);
 
-    check_full_board(rows, columns, positions); 
-    display_board(board, rows, columns);
-    play_game(board, rows, columns, positions, pOType, pXType, currentPlayer);
+    account_row(game, chosenRow, 1, shiftColumn, 1);
+
+    return shiftColumn;
 }
 
-/* Ensure that the board read from the savefile isn't full
- * A board is full if there are stones in all the interior positions
- * Exit if the board is full
+/* Place the given stone at the given row and column, moving the score of
+ * the position from the player who held it (if any) to the new stone and
+ * updating the hash to match
  * */
-void check_full_board(int rows, int columns, Position* positions) {
-    int i;
+void place_stone(GameState* game, int row, int column, char stone) {
+    Positions* positions = game->positions;
+    int index = row * positions->columns + column;
+    int score = positions->scores[index];
+    char previous = get_stone(positions, row, column);
+
+    if (previous == 'O') {
+        game->oScore -= score;
+    } else if (previous == 'X') {
+        game->xScore -= score;
+    }
+    if (previous == 'O' || previous == 'X') {
+        game->hash ^= zobrist_key(index, previous);
+    }
+
+    if (stone == 'O') {
+        game->oScore += score;
+    } else if (stone == 'X') {
+        game->xScore += score;
+    }
+    if (stone == 'O' || stone == 'X') {
+        game->hash ^= zobrist_key(index, stone);
+    }
+
+    set_stone(positions, row, column, stone);
+}
+
+/* Add up the scores of the positions set in the given plane in one row,
+ * between the first and last columns (inclusive)
+ * The scores of all the rows are contiguous, so the kernel is given every
+ * score from the row's to the end of the board, and only guards the last
+ * row against reading past them
+ * Return the total score
+ * */
+int row_score(Positions* positions, uint64_t* plane, int row,
+	int firstColumn, int lastColumn) {
+    int score = 0;
+    STATS_START;
+
+    if (firstColumn <= lastColumn) {
+        score = maskedSum(plane_row(positions, plane, row),
+		positions->scores + (size_t)row * positions->columns,
+		firstColumn, lastColumn,
+		(size_t)(positions->rows - row) * positions->columns);
+    }
+
+    STATS_STOP(STAT_ROW_SCORE);
+    return score;
+}
+
+/* Choose the widest row scoring kernel the processor supports, falling
+ * back to adding one set bit at a time
+ * */
+void choose_masked_sum(void) {
+#ifdef SIMD_X86
+    if (__builtin_cpu_supports("avx2")) {
+        maskedSum = masked_sum_avx2;
+    } else if (__builtin_cpu_supports("sse2")) {
+        maskedSum = masked_sum_sse2;
+    }
+#endif
+}
+
+/* Add up the scores of the positions between first and last whose bits
+ * are set in words, one set bit at a time
+ * Return the total score
+ * */
+int masked_sum_scalar(uint64_t* words, unsigned char* scores, int first,
+	int last, size_t length) {
+    int word, score = 0;
+
+    (void)length;
+
+    for (word = first / PLANE_BITS; word <= last / PLANE_BITS; word++) {
+        uint64_t bits = words[word] & column_mask(word, first, last);
 
-    for (i = 0; i < rows * columns; i++) {
-        if (i == rows * columns - 1) {
-            fprintf(stderr, "Full board in load\n");
-            exit(6);
+        while (bits) {
+            score += scores[word * PLANE_BITS + __builtin_ctzll(bits)];
+            bits &= bits - 1;
         }
+    }
+
+    return score;
+}
+
+#ifdef SIMD_X86
+/* Add up the scores masked by each word 16 at a time: the byte of the word
+ * for each half of a vector is copied across that half, and each of its
+ * bytes compared with the bit for that byte, giving a mask of whole bytes
+ * which selects the scores to add; parts of the word with no bits set are
+ * skipped, so narrow rows only load the scores they cover
+ * Spans shorter than SIMD_MIN_SPAN, and a word which would read past the
+ * end of the scores, are added a bit at a time
+ * */
+__attribute__((target("sse2")))
+int masked_sum_sse2(uint64_t* words, unsigned char* scores, int first,
+	int last, size_t length) {
+    const uint64_t spread = 0x0101010101010101ULL;
+    __m128i select = _mm_set1_epi64x(0x8040201008040201ULL);
+    __m128i total = _mm_setzero_si128();
+    int word, part, score = 0;
+
+    if (last - first + 1 < SIMD_MIN_SPAN) {
+        return masked_sum_scalar(words, scores, first, last, length);
+    }
+
+    for (word = first / PLANE_BITS; word <= last / PLANE_BITS; word++) {
+        uint64_t bits = words[word] & column_mask(word, first, last);
+        unsigned char* wordScores = scores + word * PLANE_BITS;
 
-        if (outer_position(positions[i].row, positions[i].column, rows,
-                columns)) {
+        if (bits == 0) {
             continue;
+        } else if ((size_t)word * PLANE_BITS + PLANE_BITS > length) {
+            score += masked_sum_scalar(words, scores,
+		    first > word * PLANE_BITS ? first : word * PLANE_BITS,
+		    last, length);
+            break;
         }
 
-        if (positions[i].stone == '.') {
-            break;
+        for (part = 0; part < PLANE_BITS; part += 16) {
+            uint64_t half = bits >> part;
+            __m128i mask;
+
+            if ((half & 0xffff) == 0) {
+                continue;
+            }
+            mask = _mm_set_epi64x((half >> 8 & 0xff) * spread,
+		    (half & 0xff) * spread);
+            mask = _mm_cmpeq_epi8(_mm_and_si128(mask, select), select);
+            total = _mm_add_epi64(total, _mm_sad_epu8(_mm_and_si128(mask,
+		    _mm_loadu_si128((__m128i*)(wordScores + part))),
+		    _mm_setzero_si128()));
         }
     }
+
+    return score + _mm_cvtsi128_si64(total) +
+	    _mm_cvtsi128_si64(_mm_unpackhi_epi64(total, total));
 }
 
-/* Ensure that the contents in the savefile are valid
- * Exit if the current player type is invalid
- * Exit if the number of rows and columns are invalid or incorrect
- * Return an array of the rows of the board on success
+/* Add up the scores masked by each word 32 at a time, as masked_sum_sse2
+ * does with vectors twice as wide
  * */
-char** check_savefile(char* buffer) {
-    int rows, columns, numRows = 0;
-    char** separatedRows = NULL;
-    char* position = strtok(buffer, "\n");
+__attribute__((target("avx2")))
+int masked_sum_avx2(uint64_t* words, unsigned char* scores, int first,
+	int last, size_t length) {
+    const uint64_t spread = 0x0101010101010101ULL;
+    __m256i select = _mm256_set1_epi64x(0x8040201008040201ULL);
+    __m256i total = _mm256_setzero_si256();
+    int word, part, score = 0;
 
-    /* Check that the number of rows and columns are valid */
-    if (sscanf(buffer, "%d %d", &rows, &columns) != 2) {
-        fprintf(stderr, "Invalid file contents\n");
-        exit(4);
+    if (last - first + 1 < SIMD_MIN_SPAN) {
+        return masked_sum_scalar(words, scores, first, last, length);
     }
 
-    /* Separate each row of the board to check their contents */
-    while (position) {
-        separatedRows = realloc(separatedRows, sizeof(char*) * ++numRows);
-        if (separatedRows == NULL) {
-            fprintf(stderr, "Invalid file contents\n");
+    for (word = first / PLANE_BITS; word <= last / PLANE_BITS; word++) {
+        uint64_t bits = words[word] & column_mask(word, first, last);
+        unsigned char* wordScores = scores + word * PLANE_BITS;
+
+        if (bits == 0) {
+            continue;
+        } else if ((size_t)word * PLANE_BITS + PLANE_BITS > length) {
+            score += masked_sum_scalar(words, scores,
+		    first > word * PLANE_BITS ? first : word * PLANE_BITS,
+		    last, length);
+            break;
+        }
+
+        for (part = 0; part < PLANE_BITS; part += 32) {
+            uint64_t quarter = bits >> part;
+            __m256i mask;
+
+            if ((quarter & 0xffffffff) == 0) {
+                continue;
+            }
+            mask = _mm256_set_epi64x((quarter >> 24 & 0xff) * spread,
+		    (quarter >> 16 & 0xff) * spread,
+		    (quarter >> 8 & 0xff) * spread, (quarter & 0xff) * spread);
+            mask = _mm256_cmpeq_epi8(_mm256_and_si256(mask, select), select);
+            total = _mm256_add_epi64(total, _mm256_sad_epu8(
+		    _mm256_and_si256(mask, _mm256_loadu_si256(
+		    (__m256i*)(wordScores + part))), _mm256_setzero_si256()));
         }
-        separatedRows[numRows - 1] = position;
-        position = strtok(NULL, "\n");
     }
-    
-    separatedRows = realloc(separatedRows, sizeof(char*) * (numRows + 1));
-    separatedRows[numRows] = 0;
-
-    check_game_setup(rows, columns, numRows, separatedRows);
-    check_board(rows, columns, numRows, separatedRows);
 
-    return separatedRows;
+    return score + _mm256_extract_epi64(total, 0) +
+	    _mm256_extract_epi64(total, 1) + _mm256_extract_epi64(total, 2) +
+	    _mm256_extract_epi64(total, 3);
 }
+#endif
 
-/* Ensure that the board specified in the savefile is correct and valid
- * Exit if the stones are invalid or if the scores are invalid
+/* Add up the scores of the positions set in the given plane in one column,
+ * between the first and last rows (inclusive)
+ * Return the total score
  * */
-void check_board(int rows, int columns, int numRows, char** separatedRows) {
-    int i, j;
+int column_score(Positions* positions, uint64_t* plane, int column,
+	int firstRow, int lastRow) {
+    int row, score = 0;
+    STATS_START;
 
-    /* Check the positions in the interior rows of the board */
-    for (i = 3; i < numRows - 1; i++) {
-        for (j = 0; j < columns * 2; j += 2) {
-            if (!isdigit(separatedRows[i][j])) {
-                fprintf(stderr, "Invalid file contents\n");
-                exit(4);
-            }
-            if (separatedRows[i][j + 1] != '.' && separatedRows[i][j + 1] !=
-                    'X' && separatedRows[i][j + 1] != 'O') {
-                fprintf(stderr, "Invalid file contents\n");
-                exit(4);
-            }
+    for (row = firstRow; row <= lastRow; row++) {
+        if (test_position(positions, plane, row, column)) {
+            score += positions->scores[(size_t)row * positions->columns +
+		    column];
         }
     }
 
-    /* Check the positions in the first and last row */
-    for (i = 2; i < numRows; i += (rows + 1)) {
-        for (j = 2; j < columns * 2 - 2; j += 2) {
-            if (!isdigit(separatedRows[i][j])) {
-                fprintf(stderr, "Invalid file contents\n");
-                exit(4);
-            }
-            if (separatedRows[i][j + 1] != '.' && separatedRows[i][j + 1] !=
-                    'X' && separatedRows[i][j + 1] != 'O') {
-                fprintf(stderr, "Invalid file contents\n");
-                exit(4);
-            }
-        }
-    } 
+    STATS_STOP(STAT_COLUMN_SCORE);
+    return score;
 }
 
-/* Ensure that the savefile contents are correct and valid
- * Check the specified current player, the the number of rows and columns
- * are correct and that all of the corner positions of the board are empty
+/* Add up the scores of every position set in the given plane
+ * Return the total score
  * */
-void check_game_setup(int rows, int columns, int numRows, 
-	char** separatedRows) {
-    int i;
+int plane_score(Positions* positions, uint64_t* plane) {
+    int r, score = 0;
+    STATS_START;
 
-    /* Check the current player type */
-    char currentPlayer = separatedRows[1][0];
-    if (strlen(separatedRows[1]) != 1 || (currentPlayer != 'O' && 
-	    currentPlayer != 'X')) {
-        fprintf(stderr, "Invalid file contents\n");
-        exit(4);
+    for (r = 0; r < positions->rows; r++) {
+        score += row_score(positions, plane, r, 0, positions->columns - 1);
     }
 
-    /* Check that the number of rows is correct */
-    if (numRows != rows + 2) {
-        fprintf(stderr, "Invalid file contents\n");
-        exit(4);
+    STATS_STOP(STAT_PLANE_SCORE);
+    return score;
+}
+
+/* Combine the Zobrist keys of the positions set in the given plane in one
+ * row, between the first and last columns (inclusive), which hold the given
+ * stone
+ * Return the combined key
+ * */
+uint64_t row_hash(Positions* positions, uint64_t* plane, int row,
+	int firstColumn, int lastColumn, char stone) {
+    uint64_t* planeRow = plane_row(positions, plane, row);
+    uint64_t hash = 0;
+    int word, first = row * positions->columns;
+
+    if (firstColumn > lastColumn) {
+        return 0;
     }
 
-    /* Check that the number of columns is correct */
-    for (i = 2; i < numRows; i++) {
-        if (strlen(separatedRows[i]) != columns * 2) {
-            fprintf(stderr, "Invalid file contents\n");
-            exit(4);
+    for (word = firstColumn / PLANE_BITS; word <= lastColumn / PLANE_BITS;
+	    word++) {
+        uint64_t bits = planeRow[word] & column_mask(word, firstColumn,
+		lastColumn);
+
+        while (bits) {
+            hash ^= zobrist_key(first + word * PLANE_BITS +
+		    __builtin_ctzll(bits), stone);
+            bits &= bits - 1;
         }
     }
 
-    /* Check board contents*/
-    if (!correct_corner_position(separatedRows, rows, columns)) {
-        fprintf(stderr, "Invalid file contents\n");
-        exit(4);
-    }
+    return hash;
 }
 
-/* Ensure that the corner positions of the board are empty
- * Return true if the corner positions are empty, or false otherwise
+/* Combine the Zobrist keys of the positions set in the given plane in one
+ * column, between the first and last rows (inclusive), which hold the given
+ * stone
+ * Return the combined key
  * */
-bool correct_corner_position(char** separatedRows, int rows, int columns) {
-    if (separatedRows[2][0] == ' ') {
-	return true;
-    } else if (separatedRows[2][1] == ' ') {
-	return true;
-    } else if (separatedRows[2][columns * 2 - 2] == ' ') {
-	return true;
-    } else if (separatedRows[2][columns * 2 - 1] == ' ') {
-	return true;
-    } else if (separatedRows[rows + 1][0] == ' ') {
-	return true;
-    } else if (separatedRows[rows + 1][1] == ' ') {
-	return true;
-    } else if (separatedRows[rows + 1][columns * 2 - 2] == ' ') {
-	return true;
-    } else if (separatedRows[rows + 1][columns * 2 - 1] == ' ') {
-	return true;
-    } else {
-	return false;
+uint64_t column_hash(Positions* positions, uint64_t* plane, int column,
+	int firstRow, int lastRow, char stone) {
+    uint64_t hash = 0;
+    int row;
+
+    for (row = firstRow; row <= lastRow; row++) {
+        if (test_position(positions, plane, row, column)) {
+            hash ^= zobrist_key(row * positions->columns + column, stone);
+        }
     }
+
+    return hash;
 }
 
-/* Initiate game play
- * Prompt for the correct move type depending on player types
- * Update and display the board after each move
- * Print the winner of the game once the game is over
+/* Combine the Zobrist keys of every position set in the given plane, which
+ * hold the given stone
+ * Return the combined key
  * */
-void play_game(char** board, int rows, int columns, Position* positions, 
-	char pOType, char pXType, char* currentPlayer) {
-    while (!game_over(positions, rows, columns)) {
-        if (*currentPlayer == 'O' && pOType == 'H') {
-            human_o_move(board, rows, columns, positions, currentPlayer);
-        } else if (*currentPlayer == 'X' && pXType == 'H') {
-            human_x_move(board, rows, columns, positions, currentPlayer);
-        } else if (*currentPlayer == 'O' && pOType != 'H') {
-            automated_o_move(rows, columns, positions, pOType, currentPlayer);
-	} else {
-            automated_x_move(rows, columns, positions, pXType, currentPlayer);
-        }
+uint64_t plane_hash(Positions* positions, uint64_t* plane, char stone) {
+    uint64_t hash = 0;
+    int r;
 
-        update_board(board, positions, rows, columns);
-        display_board(board, rows, columns);       
+    for (r = 0; r < positions->rows; r++) {
+        hash ^= row_hash(positions, plane, r, 0, positions->columns - 1,
+		stone);
     }
 
-    display_winners(positions, rows, columns);            
+    return hash;
 }
 
-/* Update the board once a move has been made
+/* Take the stones in one row, between the first and last columns
+ * (inclusive), out of the running scores and hash (sign -1) or put them
+ * back in (sign 1)
+ * A push takes out the stones it is about to move and puts them back once
+ * they have moved
  * */
-void update_board(char** board, Position* positions, int rows, int columns) {
-    int i;
+void account_row(GameState* game, int row, int firstColumn, int lastColumn,
+	int sign) {
+    Positions* positions = game->positions;
 
-    for (i = 0; i < rows * columns; i++) {
-        if (positions[i].stone == ' ') {
-            board[positions[i].row][positions[i].column * 2] = ' ';
-        } else {
-            board[positions[i].row][positions[i].column * 2] = 
-		    positions[i].score + '0';
-        }
+    game->oScore += sign * row_score(positions, positions->oPlane, row,
+	    firstColumn, lastColumn);
+    game->xScore += sign * row_score(positions, positions->xPlane, row,
+	    firstColumn, lastColumn);
+    game->hash ^= row_hash(positions, positions->oPlane, row, firstColumn,
+	    lastColumn, 'O') ^ row_hash(positions, positions->xPlane, row,
+	    firstColumn, lastColumn, 'X');
+}
 
-        board[positions[i].row][positions[i].column * 2 + 1] = 
-	        positions[i].stone;
-    }
+/* Take the stones in one column, between the first and last rows
+ * (inclusive), out of the running scores and hash (sign -1) or put them
+ * back in (sign 1)
+ * */
+void account_column(GameState* game, int column, int firstRow, int lastRow,
+	int sign) {
+    Positions* positions = game->positions;
+
+    game->oScore += sign * column_score(positions, positions->oPlane, column,
+	    firstRow, lastRow);
+    game->xScore += sign * column_score(positions, positions->xPlane, column,
+	    firstRow, lastRow);
+    game->hash ^= column_hash(positions, positions->oPlane, column, firstRow,
+	    lastRow, 'O') ^ column_hash(positions, positions->xPlane, column,
+	    firstRow, lastRow, 'X');
 }
 
-/* Print the current board
+/* Return the current score for player O
  * */
-void display_board(char** board, int rows, int columns) {
-    int r, c;
+int get_o_score(GameState* game) {
+    return game->oScore;
+}
 
-    for (r = 0; r < rows; r++) {
-        for (c = 0; c < columns * 2 + 1; c++) {
-            printf("%c", board[r][c]);
-        }
-    }
+/* Return the current score for player X
+ * */
+int get_x_score(GameState* game) {
+    return game->xScore;
 }
 
-/* Carry out a move for player O when they are an automated player
+/* Check to see if a push from the position given by the specified row and
+ * column would decrease the opposing player's score
+ * Return true if the opposing player's score is lowered and false otherwise
  * */
-void automated_o_move(int rows, int columns, Position* positions, char pOType, 
+bool decrease_score(GameState* game, int chosenRow, int chosenColumn,
 	char* currentPlayer) {
-    int chosenRow, chosenColumn;
-
-    if (pOType == '0') {
-        chosenRow = 1;
-        chosenColumn = 1;
-        while (!valid_position(chosenRow, chosenColumn, rows, columns, 
-		positions)) {
-            if (chosenColumn == columns - 2) {
-                chosenColumn = 1;
-                chosenRow++;
-            } else {
-                chosenColumn++;
-            }
-        }
+    MoveRecord move;
+    int otherScore;
+    bool decreased;
+    STATS_START;
 
-        int i;
-        for (i = 0; i < rows * columns; i++) {
-            if (positions[i].row == chosenRow && positions[i].column == 
-		    chosenColumn) {
-                positions[i].stone = *currentPlayer;
-            }
-        }
+    if (*currentPlayer == 'O') {
+        otherScore = get_x_score(game);
     } else {
-        int* chosenPosition = (int*)malloc(sizeof(int) * 2);
-        chosenPosition = type1(positions, rows, columns, currentPlayer);
-        chosenRow = chosenPosition[0];
-        chosenColumn = chosenPosition[1];
+        otherScore = get_o_score(game);
+    }
 
-        if (outer_position(chosenRow, chosenColumn, rows, columns)) {
-            push_stones(chosenRow, chosenColumn, rows, columns, positions, 
-		    currentPlayer);
-        } else {
-            int i;
-            for (i = 0; i < rows * columns; i++) {
-                if (positions[i].row == chosenRow && positions[i].column == 
-			chosenColumn) {
-                    positions[i].stone = *currentPlayer;
-                }
-            }
-        }
+    apply_move(game, chosenRow, chosenColumn, *currentPlayer, &move);
+    if (*currentPlayer == 'O') {
+        decreased = get_x_score(game) < otherScore;
+    } else {
+        decreased = get_o_score(game) < otherScore;
     }
-    printf("Player %c placed at %d %d\n", *currentPlayer, chosenRow, 
-	    chosenColumn);
+    undo_move(game, &move);
 
-    *currentPlayer = 'X';
+    STATS_STOP(STAT_DECREASE_SCORE);
+    return decreased;
 }
 
-/* Carry out a move for player X when they are an automated player
+/* Allocate a move list large enough to hold every legal move that can
+ * arise from the given positions, from the given arena or the heap if it is
+ * NULL
+ * Every move fills an empty position, so there can never be more legal moves
+ * than there are empty positions now
  * */
-void automated_x_move(int rows, int columns, Position* positions, char pXType, 
-	char* currentPlayer) {
-    int chosenRow = rows - 2, chosenColumn = columns - 2;
-
-    if (pXType == '0') {
-        while (!valid_position(chosenRow, chosenColumn, rows, columns, 
-		positions)) {
-            if (chosenColumn == 1) {
-                chosenColumn = columns - 2;
-                chosenRow--;
-            } else {
-                chosenColumn--;
-            }
-        }
- 
-        int i;
-        for (i = 0; i < rows * columns; i++) {
-            if (positions[i].row == chosenRow && positions[i].column == 
-		    chosenColumn) {
-                positions[i].stone = *currentPlayer;
-            }
+void init_move_list(MoveList* moves, Positions* positions, Arena* arena) {
+    moves->capacity = count_empty(positions) + 1;
+    moves->moves = (int*)arena_alloc(arena, sizeof(int) * moves->capacity);
+    moves->count = 0;
+    moves->edgeCount = 0;
+}
+
+/* Free the moves held by the given move list, if they are on the heap
+ * */
+void free_move_list(MoveList* moves) {
+    free(moves->moves);
+}
+
+/* Fill the move list with every legal move in the current position
+ * Pushes come first, going clockwise around the edge from the top left
+ * corner (the order type 1 players try them in), followed by the empty
+ * interior positions in row major order
+ * */
+void generate_moves(GameState* game, MoveList* moves) {
+    Positions* positions = game->positions;
+    int rows = positions->rows, columns = positions->columns, r, c, word;
+
+    moves->count = 0;
+    moves->edgeCount = 0;
+    if (rows < 3 || columns < 3) {
+        return;
+    }
+
+    for (c = 1; c < columns - 1; c++) {
+        add_edge_move(positions, moves, 0, c);
+    }
+    for (r = 1; r < rows - 1; r++) {
+        add_edge_move(positions, moves, r, columns - 1);
+    }
+    for (c = columns - 2; c > 0; c--) {
+        add_edge_move(positions, moves, rows - 1, c);
+    }
+    for (r = rows - 2; r > 0; r--) {
+        add_edge_move(positions, moves, r, 0);
+    }
+    moves->edgeCount = moves->count;
+
+    for (r = 1; r < rows - 1; r++) {
+        uint64_t* emptyRow = plane_row(positions, positions->emptyPlane, r);
+
+        if (positions->rowEmpties[r] == 0) {
+            continue;
         }
-    } else {
-        int* chosenPosition = (int*)malloc(sizeof(int) * 2);
-        chosenPosition = type1(positions, rows, columns, currentPlayer);
-        chosenRow = chosenPosition[0];
-        chosenColumn = chosenPosition[1];
 
-        if (outer_position(chosenRow, chosenColumn, rows, columns)) {
-            push_stones(chosenRow, chosenColumn, rows, columns, positions, 
-		    currentPlayer);
-        } else {
-            int i;
-            for (i = 0; i < rows * columns; i++) {
-                if (positions[i].row == chosenRow && positions[i].column == 
-			chosenColumn) {
-                    positions[i].stone = *currentPlayer;
-                }
+        for (word = 0; word < positions->rowWords; word++) {
+            uint64_t bits = emptyRow[word] & column_mask(word, 1,
+		    columns - 2);
+
+            while (bits) {
+                moves->moves[moves->count++] = r * columns + word *
+			PLANE_BITS + __builtin_ctzll(bits);
+                bits &= bits - 1;
             }
         }
     }
-    printf("Player %c placed at %d %d\n", *currentPlayer, chosenRow, 
-	    chosenColumn);
-
-    *currentPlayer = 'O';
 }
 
-/* Find a valid type 1 move for automated players
- * Return an array of the coordinates of the position to be played
- * */
-int* type1(Position* positions, int rows, int columns, char* currentPlayer) {
-    int i, *chosenPosition = (int*)malloc(sizeof(int) * 2);
-    for (i = 1; i < columns - 1; i++) {
-        if (valid_position(0, i, rows, columns, positions) && decrease_score(
-		positions, 0, i, rows, columns, currentPlayer)) {
-            chosenPosition[0] = 0;
-            chosenPosition[1] = i;
-            return chosenPosition;
-        }
-    }
-			
-    for (i = 1; i < rows - 1; i++) {
-        if (valid_position(i, columns - 1, rows, columns, positions)
-  	        && decrease_score(positions, i, columns - 1, rows,
-                columns, currentPlayer)) {
-            chosenPosition[0] = i;
-            chosenPosition[1] = columns - 1;
-            return chosenPosition;
-        }
-    }
+/* Add a push from the given edge position to the move list if it is legal
+ * */
+void add_edge_move(Positions* positions, MoveList* moves, int row,
+	int column) {
+    if (test_position(positions, positions->emptyPlane, row, column) &&
+	    valid_push(row, column, positions)) {
+        moves->moves[moves->count++] = row * positions->columns + column;
+    }
+}
+
+/* Check to see if the game is over
+ * The game is over when all interior positions in the board are full
+ * Return true if the game is over and false otherwise
+ * */
+bool game_over(Positions* positions) {
+    return positions->interiorEmpties == 0;
+}
+
+/* Print the winning player after the game is over
+ * Print both players if the game was a tie
+ * */
+void display_winners(GameState* game) {
+    if (get_o_score(game) > get_x_score(game)) {
+        printf("Winners: O\n");
+    } else if (get_x_score(game) > get_o_score(game)) {
+        printf("Winners: X\n");
+    } else {
+        printf("Winners: O X\n");
+    }
+}
+
+/* Save the board to a file in a way that is readable
+ * The dimensions of the board and the current player are printed to the
+ * top of the file
+ * Print an error if the output file could not be written
+ * Return true if the board was saved
+ * */
+bool save_game(BoardText* text, Positions* positions, char* fileName,
+	char* currentPlayer) {
+    FILE* outputFile = fopen(fileName, "w");
+    bool saved;
 
-    for (i = columns - 2; i > 0; i--) {
-        if (valid_position(rows - 1, i, rows, columns, positions) &&
-                decrease_score(positions, rows - 1, i, rows, columns,
-                currentPlayer)) {
-            chosenPosition[0] = rows - 1;
-            chosenPosition[1] = i;
-            return chosenPosition;
-        }
+    if (outputFile == 0) {
+        fprintf(stderr, "Save failed\n");
+        return false;
     }
 
-    for (i = rows - 2; i > 0; i--) {
-        if (valid_position(i, 0, rows, columns, positions) && decrease_score(
-		positions, i, 0, rows, columns, currentPlayer)) {
-            chosenPosition[0] = i;
-            chosenPosition[1] = 0;
-            return chosenPosition;
+    fprintf(outputFile, "%d %d\n%c\n", positions->rows,
+	    positions->columns, currentPlayer[0]);
+    if (text->text == NULL) {
+        write_board(positions, outputFile);
+    } else {
+        if (text->stale) {
+            render_board(text, positions);
         }
+        fwrite(text->text, sizeof(char), text->length, outputFile);
     }
-			
-    int highScore = positions[0].score;
-    for (i = 0; i < rows * columns; i++) {
-        if (positions[i].score > highScore && valid_position(positions[i].row, 
-		positions[i].column, rows, columns, positions)) {
-            highScore = positions[i].score;
-            chosenPosition[0] = positions[i].row;
-            chosenPosition[1] = positions[i].column;
-        }
+
+    saved = !ferror(outputFile);
+    if (fclose(outputFile) != 0 || !saved) {
+        fprintf(stderr, "Save failed\n");
+        return false;
     }
-    return chosenPosition;
+    return true;
 }
 
-/* Carry out a move for player O when they are a human player
+/* Save the board to a file in the binary savefile format, building the
+ * whole file in memory and writing it at once
+ * Return true if the board was saved
  * */
-void human_o_move(char** board, int rows, int columns, Position* positions, 
-	char* currentPlayer) {
-    int chosenRow = 0, chosenColumn = 0;
-    
-    while (!valid_position(chosenRow, chosenColumn, rows, columns, 
-	    positions)) {
-        char* buffer = (char*)malloc(sizeof(char) * 81);
-        printf("%c:(R C)> ", *currentPlayer);
-        
-        int c = fgetc(stdin), i = 1;
-        if (c == EOF) {
-            fprintf(stderr, "End of file\n");
-            exit(5);
-        }
-
-        buffer[0] = c;
-        while (c = fgetc(stdin), c != '\n' && c != EOF) {
-            buffer[i] = c;
-            i++;
-        }
-        buffer[i] = '\0';
+bool save_binary(Positions* positions, char* fileName, char currentPlayer) {
+    size_t size = (size_t)positions->rows * positions->columns;
+    size_t length = BINARY_HEADER + (size + 3) / 4 + (size + 1) / 2;
+    unsigned char* data = (unsigned char*)calloc(length, 1);
+    unsigned char* stones = data + BINARY_HEADER;
+    unsigned char* scores = stones + (size + 3) / 4;
+    FILE* outputFile;
+    bool saved;
+    int r;
 
-        size_t len = strlen(buffer);
+    memcpy(data, BINARY_MAGIC, BINARY_MAGIC_LENGTH);
+    data[BINARY_MAGIC_LENGTH] = BINARY_VERSION;
+    data[7] = currentPlayer;
+    write_little_endian(data + 8, positions->rows, 4);
+    write_little_endian(data + 12, positions->columns, 4);
 
-        if (buffer[0] == 's' && len > 1) {
-            char* fileName = (char*)malloc(sizeof(char) * 80);
-            int j;
+    for (r = 0; r < positions->rows; r++) {
+        encode_row(positions, r, stones, scores, size);
+    }
+    write_little_endian(data + 16, binary_checksum(stones,
+	    length - BINARY_HEADER), 8);
 
-            for (j = 1; j <= len; j++) {
-                fileName[j - 1] = buffer[j];
-            }
-            save_game(board, rows, columns, fileName, currentPlayer);
-        } else {
-            sscanf(buffer, "%d %d", &chosenRow, &chosenColumn);
-        }
+    outputFile = fopen(fileName, "wb");
+    saved = outputFile != NULL &&
+	    fwrite(data, 1, length, outputFile) == length;
+    if (outputFile != NULL && fclose(outputFile) != 0) {
+        saved = false;
     }
 
-    int i;
-    if (outer_position(chosenRow, chosenColumn, rows, columns)) {
-        push_stones(chosenRow, chosenColumn, rows, columns, positions, 
-		currentPlayer);
-    } else {
-        for (i = 0; i < rows * columns; i++) {
-            if (positions[i].row == chosenRow && positions[i].column == 
-		    chosenColumn) {
-                positions[i].stone = *currentPlayer;
-            }
-        }   
-    } 
-    *currentPlayer = 'X';
+    free(data);
+    return saved;
 }
 
-/* Carry out a move for player X when they are a human player
+#ifdef STATS
+/* Return a count of processor cycles (or of nanoseconds where there is no
+ * cycle counter) for timing short calls
  * */
-void human_x_move(char** board, int rows, int columns, Position* positions, 
-	char* currentPlayer) {
-    int chosenRow = 0, chosenColumn = 0;
+uint64_t read_cycles(void) {
+#ifdef SIMD_X86
+    return __rdtsc();
+#else
+    struct timespec now;
 
-    while (!valid_position(chosenRow, chosenColumn, rows, columns, 
-	    positions)) {
-        char* buffer = (char*)malloc(sizeof(char) * 81);
-        printf("%c:(R C)> ", *currentPlayer);
-
-        int c = fgetc(stdin), i = 1;
-        if (c == EOF) {
-            fprintf(stderr, "End of file\n");
-            exit(5);
-        } 
-        
-        buffer[0] = c;
-        while (c = fgetc(stdin), c != '\n' && c != EOF) {
-            buffer[i] = c;
-            i++;
-        }
-        buffer[i] = '\0';       
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+#endif
+}
 
-        size_t len = strlen(buffer);       
+/* Count a call to the given kind of instrumented function which started
+ * at the given cycle count
+ * */
+void record_call(int kind, uint64_t start) {
+    __atomic_fetch_add(&stats.calls[kind].calls, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&stats.calls[kind].cycles, read_cycles() - start,
+	    __ATOMIC_RELAXED);
+}
 
-        if (buffer[0] == 's' && len > 1) {
-            char* fileName = (char*)malloc(sizeof(char) * 80);
+/* Record the think time of an automated move which started at the given
+ * time (ms), and the nodes visited and bytes allocated since the given
+ * counts
+ * */
+void record_move(char player, double start, long long nodes,
+	long long bytes) {
+    MoveStats move;
 
-            int j;
-            for (j = 1; j <= len; j++) {
-                fileName[j - 1] = buffer[j];
-            }
-            save_game(board, rows, columns, fileName, currentPlayer);
-        } else {
-            sscanf(buffer, "%d %d", &chosenRow, &chosenColumn);
-        }
-        free(buffer);
-    }
+    move.player = player;
+    move.time = now_ms() - start;
+    move.nodes = __atomic_load_n(&stats.nodes, __ATOMIC_RELAXED) - nodes;
+    move.bytes = __atomic_load_n(&stats.allocatedBytes, __ATOMIC_RELAXED) -
+	    bytes;
 
-    int i;
-    if (outer_position(chosenRow, chosenColumn, rows, columns)) {
-        push_stones(chosenRow, chosenColumn, rows, columns, positions, 
-		currentPlayer);
-    } else {
-        for (i = 0; i < rows * columns; i++) {
-            if (positions[i].row == chosenRow && positions[i].column == 
-		    chosenColumn) {
-                positions[i].stone = *currentPlayer;
-            }
-        }
+    pthread_mutex_lock(&stats.lock);
+    if ((stats.moveCount & (stats.moveCount - 1)) == 0) {
+        stats.moves = (MoveStats*)realloc(stats.moves, sizeof(MoveStats) *
+		(stats.moveCount == 0 ? 1 : stats.moveCount * 2));
     }
-    *currentPlayer = 'O';
+    stats.moves[stats.moveCount++] = move;
+    pthread_mutex_unlock(&stats.lock);
 }
 
-/* Ensure that the given row and column gives a valid position
- * Return true if the position is on the interior and empty or on the edge
- * and produces a valid push
- * Return false otherwise
+/* Print everything counted so far to stderr as a JSON object
  * */
-bool valid_position(int chosenRow, int chosenColumn, int rows, int columns, 
-	Position* positions) {
+void print_stats(void) {
+    double thinkTime = 0;
     int i;
-    Position chosenPosition;
 
-    for (i = 0; i < rows * columns; i++) {
-        if (positions[i].row == chosenRow && positions[i].column == 
-		chosenColumn) {
-            chosenPosition = positions[i];
-        }
+    fprintf(stderr, "{\"calls\": {");
+    for (i = 0; i < STAT_KINDS; i++) {
+        fprintf(stderr, "%s\"%s\": {\"calls\": %lld, \"cycles\": %lld}",
+		i == 0 ? "" : ", ", statNames[i], stats.calls[i].calls,
+		stats.calls[i].cycles);
     }
 
-    if (chosenRow < 0 || chosenRow > rows - 1) {
-        return false;
-    } else if (chosenRow == 0 && chosenColumn == 0) {
-        return false;
-    } else if (chosenRow == 0 && chosenColumn == columns - 1) {
-        return false;
-    } else if (chosenRow == rows - 1 && chosenColumn == 0) {
-        return false;
-    } else if (chosenRow == rows - 1 && chosenColumn == columns - 1) {
-        return false;
-    } else if (chosenPosition.stone != '.') {
-        return false;
-    } else if (outer_position(chosenRow, chosenColumn, rows, columns) && 
-	    !valid_push(chosenRow, chosenColumn, rows, columns, positions)) {
-        return false;
-    } else {
-        return true;
+    fprintf(stderr, "}, \"moves\": [");
+    for (i = 0; i < stats.moveCount; i++) {
+        thinkTime += stats.moves[i].time;
+        fprintf(stderr, "%s{\"player\": \"%c\", \"ms\": %.3f, "
+		"\"nodes\": %lld, \"bytes\": %lld}", i == 0 ? "" : ", ",
+		stats.moves[i].player, stats.moves[i].time,
+		stats.moves[i].nodes, stats.moves[i].bytes);
     }
+
+    fprintf(stderr, "], \"think_ms\": %.3f, \"nodes\": %lld, "
+	    "\"allocations\": %lld, \"allocated_bytes\": %lld}\n",
+	    thinkTime, stats.nodes, stats.allocations, stats.allocatedBytes);
 }
 
-/* Check if the given row and column give a position on the edge of the board
- * Return true if the position is on the edge and false otherwise
+/* Allocate memory as malloc does, counting the allocation
+ * The standard functions are named in brackets so that they are not
+ * replaced by the macros which call these
  * */
-bool outer_position(int chosenRow, int chosenColumn, int rows, int columns) {
-    if (chosenRow == 0 || chosenRow == rows - 1 || chosenColumn == 0 || 
-	    chosenColumn == columns - 1) {
-        return true;
-    } else {
-        return false;
-    }
+void* stats_malloc(size_t size) {
+    STATS_ADD(allocations, 1);
+    STATS_ADD(allocatedBytes, size);
+    return (malloc)(size);
 }
 
-/* Ensure that playing a stone at the position given by the specified row and 
- * column would produce a valid push
- * A push is valid when there is an empty cell in the direction of the push
- * or there is a stone to be pushed immediately next to the position
- * Return true if the push is valid and false otherwise
+/* Allocate zeroed memory as calloc does, counting the allocation
  * */
-bool valid_push(int chosenRow, int chosenColumn, int rows, int columns, 
-	Position* positions) {
-    int i;
-    if (chosenRow == 0) {
-        if (positions[chosenColumn + columns].stone == '.') {
-            return false;
-        } else {
-            for (i = chosenColumn + (2 * columns); i < rows * columns; i += 
-		    columns) {
-                if (positions[i].stone == '.') {
-                    return true;
-                }
+void* stats_calloc(size_t count, size_t size) {
+    STATS_ADD(allocations, 1);
+    STATS_ADD(allocatedBytes, count * size);
+    return (calloc)(count, size);
+}
+
+/* Resize memory as realloc does, counting the new size as allocated
+ * */
+void* stats_realloc(void* pointer, size_t size) {
+    STATS_ADD(allocations, 1);
+    STATS_ADD(allocatedBytes, size);
+    return (realloc)(pointer, size);
+}
+#endif
+
+#ifdef BENCH
+/* Time each rules kernel on square boards from 8x8 to 1024x1024 with
+ * interiors 10%, 50%, 90% and 100% full of stones, printing one line of
+ * comma separated values for each: the kernel, the board's rows, columns
+ * and density, the operations in each timed run, and the fastest and
+ * median time of an operation over the runs (ns)
+ * The names of kernels to run may be given, otherwise all of them are run
+ * Return the exit status of the program
+ * */
+int bench_main(int argc, char** argv) {
+    BenchKernel kernels[BENCH_KERNELS] = {
+        {"push_down", bench_push_down},
+        {"push_up", bench_push_up},
+        {"push_right", bench_push_right},
+        {"push_left", bench_push_left},
+        {"valid_push", bench_valid_push},
+        {"valid_position", bench_valid_position},
+        {"plane_score", bench_plane_score},
+        {"game_over", bench_game_over},
+        {"decrease_score", bench_decrease_score},
+        {"parse_savefile", bench_parse_savefile}
+    };
+    int sizes[BENCH_SIZES] = {8, 32, 128, 512, 1024};
+    int densities[BENCH_DENSITIES] = {10, 50, 90, 100};
+    int size, density, k, i;
+
+    printf("kernel,rows,columns,density,ops,min_ns,median_ns\n");
+    for (size = 0; size < BENCH_SIZES; size++) {
+        for (density = 0; density < BENCH_DENSITIES; density++) {
+            BenchBoard board;
+
+            if (!make_bench_board(&board, sizes[size], densities[density])) {
+                continue;
             }
-            return false;
-        }
-    } else if (chosenRow == rows - 1) {
-        if (positions[chosenRow * columns + chosenColumn - columns].stone == 
-		'.') {
-            return false;
-        } else {
-            for (i = columns * (chosenRow - 1) + chosenColumn; i >= 0; i -= 
-		    columns) {
-                if (positions[i].stone == '.') {
-                    return true;
+
+            for (k = 0; k < BENCH_KERNELS; k++) {
+                double times[BENCH_REPETITIONS];
+                long long ops = 1;
+                bool chosen = argc == 1;
+                int pushes;
+
+                for (i = 1; i < argc; i++) {
+                    chosen |= strcmp(argv[i], kernels[k].name) == 0;
                 }
-            }
-            return false;
-        }
-    } else if (chosenColumn == 0) {
-        if (positions[chosenRow * columns + 1].stone == '.') {
-            return false;
-        } else {
-            for (i = chosenColumn + 1; i < columns; i++) {
-                if (positions[chosenRow * columns + i].stone == '.') {
-                    return true;
+                pushes = board.pushCounts[0] + board.pushCounts[1] +
+			board.pushCounts[2] + board.pushCounts[3];
+                if (!chosen || (k < 4 && board.pushCounts[k] == 0) ||
+			(kernels[k].run == bench_decrease_score &&
+			pushes == 0)) {
+                    continue;
                 }
-            }
-            return false;
-        }
-    } else {
-        if (positions[chosenRow * columns + chosenColumn - 1].stone == '.') {
-            return false;
-        } else {
-            for (i = chosenColumn - 1; i >= 0; i--) {
-                if (positions[chosenRow * columns + i].stone == '.') {
-                    return true;
+
+                /* The warmup run also finds how many operations make a
+                 * run last long enough to time */
+                time_kernel(&kernels[k], &board, &ops);
+                for (i = 0; i < BENCH_REPETITIONS; i++) {
+                    times[i] = time_kernel(&kernels[k], &board, &ops);
                 }
+                qsort(times, BENCH_REPETITIONS, sizeof(double),
+			compare_times);
+
+                printf("%s,%d,%d,%d,%lld,%.2f,%.2f\n", kernels[k].name,
+			sizes[size], sizes[size], densities[density], ops,
+			times[0] * 1e6 / ops,
+			times[BENCH_REPETITIONS / 2] * 1e6 / ops);
+                fflush(stdout);
             }
-            return false;
+            free_bench_board(&board);
         }
     }
-}
 
-/* If a push from the position given by the specified row and column is valid,
- * push the stones in the necessary direction
- * */
-void push_stones(int chosenRow, int chosenColumn, int rows, int columns, 
-	Position* positions, char* currentPlayer) {
-    int chosenIndex = chosenRow * columns + chosenColumn;
-    
-    if (chosenColumn == 0) {
-        right_push(positions, rows, columns, chosenIndex, currentPlayer);
-    } else if (chosenColumn == columns - 1) {
-        left_push(positions, rows, columns, chosenIndex, currentPlayer);
-    } else if (chosenRow == 0) {
-        downward_push(positions, rows, columns, chosenIndex, currentPlayer);
-    } else {
-        upward_push(positions, rows, columns, chosenIndex, currentPlayer);
-    }
+    return 0;
 }
 
-/* Push stones when a position in the first row is chosen
+/* Build a random square board of the given size whose positions other
+ * than corners hold stones with the given chance (%), and are otherwise
+ * empty, loading it from the text of its savefile
+ * Return false if the board could not be built
  * */
-void downward_push(Position* positions, int rows, int columns, 
-	int chosenIndex, char* currentPlayer) {
-    int shiftIndex = chosenIndex, i;
-    
-    for (i = chosenIndex + columns; i <= chosenIndex + (columns *
-            (rows - 1)); i += columns) {
-        if (positions[i].stone == '.') {
-            shiftIndex += columns;
-            break;
+bool make_bench_board(BenchBoard* board, int size, int density) {
+    uint64_t random = 0x9e3779b97f4a7c15ULL ^ ((uint64_t)size << 8) ^ density;
+    size_t line = (size_t)size * 2 + 1;
+    Positions* positions;
+    int r, c, i, side;
+    char* out;
+
+    board->text = (char*)malloc(line * size + 32);
+    out = board->text + sprintf(board->text, "%d %d\nO\n", size, size);
+    for (r = 0; r < size; r++) {
+        for (c = 0; c < size; c++) {
+            uint64_t value = next_random(&random);
+
+            if ((r == 0 || r == size - 1) && (c == 0 || c == size - 1)) {
+                *out++ = ' ';
+                *out++ = ' ';
+                continue;
+            }
+            *out++ = '0' + value % 10;
+            if ((value >> 8) % 100 >= (uint64_t)density) {
+                *out++ = '.';
+            } else {
+                *out++ = value >> 40 & 1 ? 'O' : 'X';
+            }
         }
-        shiftIndex += columns;
+        *out++ = '\n';
     }
-    
-    for (i = shiftIndex; i > chosenIndex + columns; i -= columns) {
-        positions[i].stone = positions[i - columns].stone;
-    }
-    
-    positions[chosenIndex + columns].stone = *currentPlayer;
-}
+    board->length = out - board->text;
 
-/* Push stones when a position in the last column is chosen
- * */
-void left_push(Position* positions, int rows, int columns, int chosenIndex, 
-	char* currentPlayer) {
-    int shiftIndex = chosenIndex, i;
-    
-    for (i = chosenIndex - 1; i > chosenIndex - columns; i--) {
-        if (positions[i].stone == '.') {
-            shiftIndex--;
-            break;
-        }
-        shiftIndex--;
+    if (parse_savefile(board->text, board->length, &positions,
+	    &board->player, NULL, NULL) == LOAD_INVALID) {
+        free(board->text);
+        return false;
     }
-    
-    for (i = shiftIndex; i < chosenIndex; i++) {
-        positions[i].stone = positions[i + 1].stone;
+    initialise_game(&board->game, positions, NULL);
+    board->sink = 0;
+
+    board->edges = (int*)malloc(sizeof(int) * 4 * size);
+    board->edgeCount = 0;
+    for (side = 0; side < 4; side++) {
+        board->pushes[side] = (int*)malloc(sizeof(int) * size);
+        board->pushCounts[side] = 0;
     }
-    
-    positions[chosenIndex - 1].stone = *currentPlayer;    
-}
+    for (i = 1; i < size - 1; i++) {
+        int edges[4][2] = {{0, i}, {size - 1, i}, {i, 0}, {i, size - 1}};
 
-/* Push stones when a position in the last row is chosen
- **/
-void upward_push(Position* positions, int rows, int columns, int chosenIndex, 
-	char* currentPlayer) {
-    int shiftIndex = chosenIndex, i;
-    
-    for (i = chosenIndex - columns; i >= chosenIndex - (columns *
-            (rows - 1)); i -= columns) {
-        if (positions[i].stone == '.') {
-            shiftIndex -= columns;
-            break;
+        for (side = 0; side < 4; side++) {
+            int index = edges[side][0] * size + edges[side][1];
+
+            board->edges[board->edgeCount++] = index;
+            if (valid_push(edges[side][0], edges[side][1], positions)) {
+                board->pushes[side][board->pushCounts[side]++] = index;
+            }
         }
-        shiftIndex -= columns;
     }
-    
-    for (i = shiftIndex; i < chosenIndex - columns; i += columns) {
-        positions[i].stone = positions[i + columns].stone;
-    }
-    
-    positions[chosenIndex - columns].stone = *currentPlayer;
+
+    return true;
 }
 
-/* Push stones when a position in the first column is chosen
+/* Free a board built by make_bench_board
  * */
-void right_push(Position* positions, int rows, int columns, int chosenIndex, 
-	char* currentPlayer) {
-    int shiftIndex = chosenIndex, i;
-    
-    for (i = chosenIndex + 1; i < chosenIndex + columns; i++) {
-        if (positions[i].stone == '.') {
-            shiftIndex++;
-            break;
-        }
-        shiftIndex++;
-    }
-    
-    for (i = shiftIndex; i > chosenIndex + 1; i--) {
-        positions[i].stone = positions[i - 1].stone;
+void free_bench_board(BenchBoard* board) {
+    int side;
+
+    for (side = 0; side < 4; side++) {
+        free(board->pushes[side]);
     }
-    
-    positions[chosenIndex + 1].stone = *currentPlayer;
+    free(board->edges);
+    free(board->text);
+    free_game(&board->game);
 }
 
-/* Read the board and calculate the score for player O
- * Return a pointer to the player's score
+/* Time one run of a kernel on a board (ms), doubling the number of
+ * operations in ops until the run takes at least BENCH_MIN_TIME
  * */
-int* get_o_score(Position* positions, int rows, int columns) {
-    int i;
-    int* oScore = (int*)malloc(sizeof(int));
-    *oScore = 0;
-    
-    for (i = 0; i < rows * columns; i++) {
-        if (positions[i].stone == 'O') {
-            *oScore += positions[i].score;
+double time_kernel(BenchKernel* kernel, BenchBoard* board, long long* ops) {
+    while (true) {
+        double start = now_ms(), elapsed;
+
+        kernel->run(board, *ops);
+        elapsed = now_ms() - start;
+        if (elapsed >= BENCH_MIN_TIME) {
+            return elapsed;
         }
+        *ops *= 2;
     }
+}
 
-    return oScore;
+/* Compare two times for sorting
+ * */
+int compare_times(const void* first, const void* second) {
+    double a = *(const double*)first, b = *(const double*)second;
+
+    return a < b ? -1 : a > b;
 }
 
-/* Read the board and calculate the score for player X
- * Return a pointer to the player's score
+/* Push from the top edge, undoing each push
  * */
-int* get_x_score(Position* positions, int rows, int columns) {
-    int i;
-    int* xScore = (int*)malloc(sizeof(int));
-    *xScore = 0;
-    
-    for (i = 0; i < rows * columns; i++) {
-        if (positions[i].stone == 'X') {
-            *xScore += positions[i].score;
-        }
-    }
+void bench_push_down(BenchBoard* board, long long ops) {
+    bench_pushes(board, 0, ops);
+}
 
-    return xScore;
+/* Push from the bottom edge, undoing each push
+ * */
+void bench_push_up(BenchBoard* board, long long ops) {
+    bench_pushes(board, 1, ops);
 }
 
-/* Check to see if a push from the position given by the specified row and
- * column would decrease the opposing player's score
- * Return true if the opposing player's score is lowered and false otherwise
+/* Push from the left edge, undoing each push
  * */
-bool decrease_score(Position* positions, int chosenRow, int chosenColumn, 
-	int rows, int columns, char* currentPlayer) {
-    int* otherScore = (int*)malloc(sizeof(int));
+void bench_push_right(BenchBoard* board, long long ops) {
+    bench_pushes(board, 2, ops);
+}
 
-    if (*currentPlayer == 'O') {
-        *otherScore = *get_x_score(positions, rows, columns);
-    } else {
-        *otherScore = *get_o_score(positions, rows, columns);
-    }
+/* Push from the right edge, undoing each push
+ * */
+void bench_push_left(BenchBoard* board, long long ops) {
+    bench_pushes(board, 3, ops);
+}
 
-    Position* temp = (Position*)malloc(sizeof(Position) * rows * columns);
-    int i;
-    for (i = 0; i < rows * columns; i++) {
-        temp[i] = positions[i];
+/* Play (with apply_move) and undo each valid push from the given side of
+ * the board in turn
+ * */
+void bench_pushes(BenchBoard* board, int side, long long ops) {
+    int columns = board->game.positions->columns, next = 0;
+    MoveRecord record;
+    long long i;
+
+    for (i = 0; i < ops; i++) {
+        int index = board->pushes[side][next];
+
+        apply_move(&board->game, index / columns, index % columns,
+		board->player, &record);
+        undo_move(&board->game, &record);
+        next = next + 1 == board->pushCounts[side] ? 0 : next + 1;
     }
+    board->sink += board->game.oScore;
+}
 
-    push_stones(chosenRow, chosenColumn, rows, columns, temp, currentPlayer);
-    if (*currentPlayer == 'O') {
-        if (*get_x_score(temp, rows, columns) < *otherScore) {
-            return true;
-        } else {
-            return false;
-        }
-    } else {
-        if (*get_o_score(temp, rows, columns) < *otherScore) {
-            return true;
-        } else {
-            return false;
-        }
+/* Check each edge position in turn for a valid push
+ * */
+void bench_valid_push(BenchBoard* board, long long ops) {
+    Positions* positions = board->game.positions;
+    int next = 0;
+    long long i;
+
+    for (i = 0; i < ops; i++) {
+        int index = board->edges[next];
+
+        board->sink += valid_push(index / positions->columns,
+		index % positions->columns, positions);
+        next = next + 1 == board->edgeCount ? 0 : next + 1;
     }
 }
 
-/* Check to see if the game is over
- * The game is over when all interior positions in the board are full
- * Return true if the game is over and false otherwise
+/* Check each position of the board in turn for a valid move
  * */
-bool game_over(Position* positions, int rows, int columns) {
-    int i;
-    
-    for (i = 0; i < rows * columns; i++) {
-        if (!outer_position(positions[i].row, positions[i].column, rows, 
-		columns) && positions[i].stone == '.') {
-            return false;
+void bench_valid_position(BenchBoard* board, long long ops) {
+    Positions* positions = board->game.positions;
+    int row = 0, column = 0;
+    long long i;
+
+    for (i = 0; i < ops; i++) {
+        board->sink += valid_position(row, column, positions);
+        if (++column == positions->columns) {
+            column = 0;
+            row = row + 1 == positions->rows ? 0 : row + 1;
         }
     }
+}
 
-    return true;
+/* Total both players' scores from scratch, as get_o_score and get_x_score
+ * are kept up to date from these totals
+ * */
+void bench_plane_score(BenchBoard* board, long long ops) {
+    Positions* positions = board->game.positions;
+    long long i;
+
+    for (i = 0; i < ops; i++) {
+        board->sink += plane_score(positions, positions->oPlane) +
+		plane_score(positions, positions->xPlane);
+    }
 }
 
-/* Print the winning player after the game is over
- * Print both players if the game was a tie
+/* Check whether the game is over
+ * The positions are read through a volatile pointer each time, as the
+ * check is otherwise hoisted out of the loop and never timed
  * */
-void display_winners(Position* positions, int rows, int columns) {
-    if (*get_o_score(positions, rows, columns) > *get_x_score(positions, rows, 
-	    columns)) {
-        printf("Winners: O\n");
-    } else if (*get_x_score(positions, rows, columns) > 
-	    *get_o_score(positions, rows, columns)) {
-        printf("Winners: X\n");
-    } else {
-        printf("Winners: O X\n");
+void bench_game_over(BenchBoard* board, long long ops) {
+    Positions* volatile positions = board->game.positions;
+    long long i;
+
+    for (i = 0; i < ops; i++) {
+        board->sink += game_over(positions);
     }
 }
 
-/* Save the board to a file in a way that is readable
- * The dimensions of the board and the current player are printed to the 
- * top of the file
- * Exit if an error occurred when opening the output file
+/* Check whether each valid push lowers the opponent's score, going round
+ * the sides of the board in turn
  * */
-void save_game(char** board, int rows, int columns, char* fileName, 
-	char* currentPlayer) {
-    FILE* outputFile = fopen(fileName, "w");
+void bench_decrease_score(BenchBoard* board, long long ops) {
+    int columns = board->game.positions->columns, side = 0, next = 0;
+    long long i;
 
-    if (outputFile == 0) {
-        fprintf(stderr, "Save failed\n");
-    } else {
-        fprintf(outputFile, "%d %d\n%c\n", rows, columns, currentPlayer[0]);
-        int r, c;
-        
-        for (r = 0; r < rows; r++) {
-            for (c = 0; c < columns * 2 + 1; c++) {
-                fputc(board[r][c], outputFile);
-            }
+    for (i = 0; i < ops; i++) {
+        int index;
+
+        while (board->pushCounts[side] == 0 ||
+		next >= board->pushCounts[side]) {
+            side = (side + 1) % 4;
+            next = 0;
         }
-        
-        fclose(outputFile);
+        index = board->pushes[side][next++];
+        board->sink += decrease_score(&board->game, index / columns,
+		index % columns, &board->player);
+    }
+}
+
+/* Load the board from the text of its savefile
+ * */
+void bench_parse_savefile(BenchBoard* board, long long ops) {
+    Positions* positions;
+    char player;
+    long long i;
+
+    for (i = 0; i < ops; i++) {
+        parse_savefile(board->text, board->length, &positions, &player,
+		NULL, NULL);
+        board->sink += positions->rowEmpties[0];
+        free_positions(positions);
     }
 }
+#endif